@@ -0,0 +1,86 @@
+#include "ast.h"
+#include "stats.h"
+
+std::string to_string(ast_type x) {
+    switch (x) {
+        case ast_type::Add: {
+            return "Add";
+        }
+        case ast_type::Sub: {
+            return "Sub";
+        }
+        case ast_type::Mul: {
+            return "Mul";
+        }
+        case ast_type::Neg: {
+            return "Neg";
+        }
+        case ast_type::Pos: {
+            return "Pos";
+        }
+        case ast_type::Num: {
+            return "Num";
+        }
+        case ast_type::Var: {
+            return "Var";
+        }
+    }
+    return "";
+}
+
+std::string ast::to_json(int indent) const {
+    PARSER_STATS_PHASE(PHASE_SERIALIZE);
+    struct frame {
+        uint32_t node;
+        int state;
+        size_t level;
+    };
+    std::string res;
+    auto new_line = [&res, indent](size_t level) {
+        if (indent >= 0) {
+            res.push_back('\n');
+            res.append(level * indent, ' ');
+        }
+    };
+    std::vector<frame> stack;
+    if (root_index != NONE) {
+        stack.push_back({root_index, 0, 0});
+    }
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        auto const &cur = nodes[top.node];
+        auto level = top.level;
+        if (top.state == 0) {
+            res.push_back('{');
+            new_line(level + 1);
+            res.push_back('"');
+            res.append(::to_string(cur.type));
+            res.append(indent >= 0 ? "\": " : "\":");
+            if (cur.type == ast_type::Num || cur.type == ast_type::Var) {
+                res.push_back('"');
+                res.append(text(top.node));
+                res.push_back('"');
+                top.state = 3;
+                continue;
+            }
+            res.push_back('[');
+            new_line(level + 2);
+            top.state = 1;
+            stack.push_back({cur.lhs, 0, level + 2});
+        } else if (top.state == 1 && cur.rhs != NONE) {
+            res.push_back(',');
+            new_line(level + 2);
+            top.state = 2;
+            stack.push_back({cur.rhs, 0, level + 2});
+        } else {
+            if (cur.type != ast_type::Num && cur.type != ast_type::Var) {
+                new_line(level + 1);
+                res.push_back(']');
+            }
+            new_line(level);
+            res.push_back('}');
+            stack.pop_back();
+        }
+    }
+    return res;
+}
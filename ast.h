@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "lexer.h"
+#include "parser.h"
+
+enum class ast_type : uint8_t {
+    Add, Sub, Mul, Neg, Pos, Num, Var
+};
+
+std::string to_string(ast_type x);
+
+struct ast_node {
+    ast_type type;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+// Operator tree with the E/X/T/Y/F chains folded away. Nodes are stored in
+// postorder, operands before the operator; Num and Var nodes keep their token index in lhs.
+class ast {
+    token_buffer toks;
+    std::vector<ast_node> nodes;
+    uint32_t root_index = NONE;
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    explicit ast(token_buffer tokens = token_buffer()) : toks(std::move(tokens)) {
+        nodes.reserve(toks.size());
+    }
+
+    // Drops the nodes and takes new tokens, keeping the node storage.
+    void reset(token_buffer tokens) {
+        toks = std::move(tokens);
+        nodes.clear();
+        nodes.reserve(toks.size());
+        root_index = NONE;
+    }
+
+    uint32_t add(ast_type type, uint32_t lhs, uint32_t rhs = NONE) {
+        nodes.push_back({type, lhs, rhs});
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    void set_root(uint32_t i) {
+        root_index = i;
+    }
+
+    uint32_t root() const {
+        return root_index;
+    }
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    ast_node const& operator[](uint32_t i) const {
+        return nodes[i];
+    }
+
+    std::string_view text(uint32_t i) const {
+        return toks.text(nodes[i].lhs);
+    }
+
+    token_buffer const& tokens() const {
+        return toks;
+    }
+
+    // Drops the nodes and gives the tokens back, so their storage can take the next input.
+    token_buffer release_tokens() {
+        nodes.clear();
+        root_index = NONE;
+        return std::move(toks);
+    }
+
+    std::string to_json(int indent = -1) const;
+};
+
+ast parse_ast(token_buffer data, parse_limits limits = parse_limits());
+void parse_ast(ast& tree, parse_limits limits = parse_limits());
@@ -0,0 +1,169 @@
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "batch.h"
+#include "ast.h"
+#include "json_writer.h"
+
+namespace {
+    struct batch {
+        size_t seq = 0;
+        size_t first_line = 0;
+        size_t size = 0;
+        std::vector<std::string> lines;
+        std::string output;
+    };
+
+    class batch_runner {
+        std::istream &in;
+        std::ostream &out;
+        batch_options options;
+
+        std::mutex lock;
+        std::condition_variable changed;
+        std::vector<batch *> free_batches;
+        std::vector<batch *> work;
+        size_t work_head = 0;
+        std::map<size_t, batch *> done;
+        size_t next_write = 0;
+        bool finished = false;
+        std::vector<std::unique_ptr<batch>> owned;
+
+        void write(batch *item) {
+            out.write(item->output.data(), static_cast<std::streamsize>(item->output.size()));
+            free_batches.push_back(item);
+            changed.notify_all();
+        }
+
+        void complete(batch *item) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!options.ordered) {
+                write(item);
+                return;
+            }
+            done.emplace(item->seq, item);
+            for (auto it = done.begin(); it != done.end() && it->first == next_write; it = done.erase(it)) {
+                write(it->second);
+                ++next_write;
+            }
+        }
+
+        void work_loop() {
+            batch_worker state;
+            while (true) {
+                batch *item;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [this] {
+                        return finished || work_head < work.size();
+                    });
+                    if (work_head == work.size()) {
+                        return;
+                    }
+                    item = work[work_head++];
+                    if (work_head == work.size()) {
+                        work.clear();
+                        work_head = 0;
+                    }
+                }
+                item->output.clear();
+                for (size_t i = 0; i < item->size; ++i) {
+                    state.process(item->lines[i], item->first_line + i, options.ast, item->output);
+                }
+                complete(item);
+            }
+        }
+
+    public:
+        batch_runner(std::istream &in, std::ostream &out, batch_options const &options)
+                : in(in), out(out), options(options) {}
+
+        void run() {
+            auto workers = std::max<size_t>(options.threads, 1);
+            auto max_in_flight = workers * 4;
+            for (size_t i = 0; i < max_in_flight; ++i) {
+                owned.push_back(std::make_unique<batch>());
+                owned.back()->lines.resize(options.lines_per_batch);
+                free_batches.push_back(owned.back().get());
+            }
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < workers; ++i) {
+                threads.emplace_back(&batch_runner::work_loop, this);
+            }
+            size_t line_no = 1;
+            for (size_t seq = 0; in; ++seq) {
+                batch *item;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [this] {
+                        return !free_batches.empty();
+                    });
+                    item = free_batches.back();
+                    free_batches.pop_back();
+                }
+                item->seq = seq;
+                item->first_line = line_no;
+                item->size = 0;
+                while (item->size < options.lines_per_batch && std::getline(in, item->lines[item->size])) {
+                    auto &line = item->lines[item->size];
+                    if (!line.empty() && line.back() == '\r') {
+                        line.pop_back();
+                    }
+                    ++item->size;
+                }
+                line_no += item->size;
+                std::lock_guard<std::mutex> guard(lock);
+                work.push_back(item);
+                changed.notify_all();
+            }
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                finished = true;
+                changed.notify_all();
+            }
+            for (auto &item : threads) {
+                item.join();
+            }
+            out.flush();
+        }
+    };
+}
+
+void batch_worker::process(std::string const &line, size_t line_no, bool as_ast, std::string &out) {
+    out.append("{\"line\":");
+    out.append(std::to_string(line_no));
+    auto begin_size = out.size();
+    // The buffer is lent to a tree for parsing and taken back, after an error too, so its
+    // storage outlives the line.
+    bool lent = false;
+    try {
+        tokens.assign(line);
+        tokenize_into(tokens);
+        lent = true;
+        if (as_ast) {
+            folded.reset(std::move(tokens));
+            parse_ast(folded);
+            out.append(",\"tree\":");
+            out.append(folded.to_json());
+        } else {
+            tree.reset(std::move(tokens));
+            parse_flat(tree);
+            out.append(",\"tree\":");
+            tree.to_json(out, -1);
+        }
+    } catch (std::exception const &e) {
+        out.resize(begin_size);
+        out.append(",\"error\":");
+        append_json_string(out, e.what());
+    }
+    if (lent) {
+        tokens = as_ast ? folded.release_tokens() : tree.release_tokens();
+    }
+    out.append("}\n");
+}
+
+void run_batch(std::istream &in, std::ostream &out, batch_options const &options) {
+    batch_runner(in, out, options).run();
+}
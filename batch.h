@@ -0,0 +1,28 @@
+#pragma once
+
+#include <iostream>
+#include "parser.h"
+#include "ast.h"
+
+struct batch_options {
+    size_t threads = 1;
+    bool ordered = true;
+    bool ast = false;
+    size_t lines_per_batch = 256;
+};
+
+// Per-worker buffers, reused for every line the worker parses.
+struct batch_worker {
+    token_buffer tokens;
+    flat_tree tree;
+    ast folded;
+
+    // Appends the JSON object for one line, followed by a newline, to out.
+    void process(std::string const &line, size_t line_no, bool as_ast, std::string &out);
+};
+
+// Parses one expression per input line on options.threads workers and writes one
+// compact JSON object per line: {"line":N,"tree":...} or {"line":N,"error":"..."}.
+// With options.ordered the output follows the input order, otherwise batches of
+// lines are written as soon as they are done.
+void run_batch(std::istream &in, std::ostream &out, batch_options const &options);
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "../lexer.h"
+#include "../parser.h"
+#include "../ast.h"
+#include "../eval.h"
+#include "../stats.h"
+
+using std::string;
+using std::vector;
+
+// Resets the kernel's peak RSS counter where supported, so each phase reports its own peak.
+static void reset_peak_memory() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+static size_t peak_memory_kb() {
+    std::ifstream status("/proc/self/status");
+    string line;
+    while (std::getline(status, line)) {
+        if (!line.compare(0, 6, "VmHWM:")) {
+            return std::stoull(line.substr(6));
+        }
+    }
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);
+}
+
+static double seconds(std::function<void()> const &run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Deterministic corpora of roughly the requested size.
+static string gen_flat(size_t size) {
+    auto generator = std::mt19937(42);
+    static constexpr char const *ops[] = {" + ", " - ", " * "};
+    string res = "1";
+    res.reserve(size + 32);
+    size_t products = 0;
+    while (res.size() < size) {
+        // Short product runs keep the value from growing without bound.
+        auto op = generator() % 3;
+        products = (op == 2) ? products + 1 : 0;
+        res.append(ops[products > 2 ? 0 : op]);
+        res.append(std::to_string(generator() % 100000));
+    }
+    return res;
+}
+
+static string gen_deep(size_t size) {
+    size_t depth = size / 8;
+    string res;
+    res.reserve(size + 32);
+    for (size_t i = 0; i < depth; ++i) {
+        res.append(i % 2 ? "(1 - " : "(2 + ");
+    }
+    res.push_back('3');
+    res.append(depth, ')');
+    return res;
+}
+
+static string gen_unary(size_t size) {
+    auto generator = std::mt19937(42);
+    string res;
+    res.reserve(size + 32);
+    while (res.size() + 1 < size) {
+        res.append(generator() % 4 ? "-" : "+ ");
+    }
+    res.push_back('7');
+    return res;
+}
+
+static string gen_mixed(size_t size) {
+    auto generator = std::mt19937(42);
+    static constexpr char const *ops[] = {" + ", " - ", " * ", "-"};
+    string res;
+    res.reserve(size + 64);
+    size_t open = 0;
+    size_t products = 0;
+    while (res.size() < size) {
+        if (generator() % 4 == 0 && open < 64) {
+            res.push_back('(');
+            ++open;
+        }
+        res.append(std::to_string(generator() % 100000));
+        if (open && generator() % 4 == 0) {
+            res.push_back(')');
+            --open;
+        }
+        auto op = generator() % 4;
+        products = (op == 2) ? products + 1 : 0;
+        res.append(ops[products > 2 ? 0 : op]);
+    }
+    res.push_back('1');
+    res.append(open, ')');
+    return res;
+}
+
+struct shape {
+    char const *name;
+    string (*generate)(size_t);
+};
+
+static constexpr shape shapes[] = {
+        {"flat", gen_flat}, {"deep", gen_deep}, {"unary", gen_unary}, {"mixed", gen_mixed}};
+
+static size_t parse_size(string const &s) {
+    size_t pos = 0;
+    auto value = std::stoull(s, &pos);
+    switch (pos < s.size() ? s[pos] : ' ') {
+        case 'K':
+        case 'k': {
+            return value << 10;
+        }
+        case 'M':
+        case 'm': {
+            return value << 20;
+        }
+        case 'G':
+        case 'g': {
+            return value << 30;
+        }
+        default: {
+            return value;
+        }
+    }
+}
+
+class reporter {
+    std::ostream &out;
+    bool first = true;
+    int runs;
+
+public:
+    reporter(std::ostream &out, int runs) : out(out), runs(runs) {
+        out << "{\"results\": [";
+    }
+
+    ~reporter() {
+        out << "\n]}\n";
+    }
+
+    // Runs the phase `runs` times and reports the best time; allocations are per run.
+    // prepare runs before every run, outside the timer and the counters.
+    void measure(char const *shape, size_t input, char const *name, std::function<void()> const &run,
+                 vector<std::pair<char const *, double>> const &units,
+                 std::function<void()> const &prepare = nullptr) {
+        double best = 0;
+        size_t allocs = 0;
+        size_t bytes = 0;
+        size_t peak = 0;
+        for (int i = 0; i < runs; ++i) {
+            if (prepare) {
+                prepare();
+            }
+            reset_peak_memory();
+            double elapsed;
+            parse_stats stats;
+            {
+                stats_scope scope(stats);
+                elapsed = seconds(run);
+            }
+            allocs = stats.allocations;
+            bytes = stats.allocated_bytes;
+            if (!i || elapsed < best) {
+                best = elapsed;
+            }
+            peak = std::max(peak, peak_memory_kb());
+        }
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "  {\"shape\": \"" << shape << "\", \"input_bytes\": " << input << ", \"phase\": \"" << name
+            << "\", \"seconds\": " << best;
+        for (auto &&item : units) {
+            out << ", \"" << item.first << "\": " << item.second / best;
+        }
+        out << ", \"allocations\": " << allocs << ", \"allocated_bytes\": " << bytes
+            << ", \"peak_rss_kb\": " << peak << "}";
+        out.flush();
+    }
+};
+
+static void print_usage() {
+    std::cerr << "Usage: parser_bench [--sizes 64K,4M,1G] [--shapes flat,deep,unary,mixed] [--runs N] [--out file]\n";
+}
+
+int main(int argc, char *argv[]) {
+    vector<size_t> sizes = {64u << 10, 4u << 20};
+    vector<string> names;
+    int runs = 3;
+    string out_path;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            print_usage();
+            return 1;
+        }
+        string value = argv[++i];
+        std::istringstream list(value);
+        string item;
+        if (arg == "--sizes") {
+            sizes.clear();
+            while (std::getline(list, item, ',')) {
+                sizes.push_back(parse_size(item));
+            }
+        } else if (arg == "--shapes") {
+            while (std::getline(list, item, ',')) {
+                names.push_back(item);
+            }
+        } else if (arg == "--runs") {
+            runs = std::max(1, std::stoi(value));
+        } else if (arg == "--out") {
+            out_path = value;
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    std::ofstream file;
+    if (!out_path.empty()) {
+        file.open(out_path);
+    }
+    reporter report(out_path.empty() ? std::cout : file, runs);
+    static constexpr std::pair<lexer_kernel, char const *> kernels[] = {
+            {KERNEL_SCALAR, "lex_scalar"}, {KERNEL_SSE2, "lex_sse2"}, {KERNEL_AVX2, "lex_avx2"}};
+    for (auto &&kind : shapes) {
+        if (!names.empty() && std::find(names.begin(), names.end(), kind.name) == names.end()) {
+            continue;
+        }
+        for (auto size : sizes) {
+            auto input = kind.generate(size);
+            auto mb = static_cast<double>(input.size()) / (1 << 20);
+            token_buffer tokens(input);
+            for (auto &&item : kernels) {
+                if (!kernel_supported(item.first)) {
+                    continue;
+                }
+                report.measure(kind.name, input.size(), item.second, [&] {
+                    tokenize_into(tokens, item.first);
+                }, {{"mb_per_second", mb}}, [&] {
+                    tokens.reset(input);
+                });
+            }
+            auto count = static_cast<double>(tokens.size());
+            auto nodes = static_cast<double>(parse_flat(tokens).size());
+            // The previous result is destroyed, and the tokens a phase takes by value are
+            // copied, before the clock starts.
+            std::optional<node> tree;
+            report.measure(kind.name, input.size(), "parse", [&] {
+                tree = parse(tokens);
+            }, {{"tokens_per_second", count}, {"nodes_per_second", nodes}}, [&] {
+                tree.reset();
+            });
+            token_buffer copy;
+            std::optional<flat_tree> flat;
+            report.measure(kind.name, input.size(), "parse_flat", [&] {
+                flat = parse_flat(std::move(copy));
+            }, {{"tokens_per_second", count}, {"nodes_per_second", nodes}}, [&] {
+                flat.reset();
+                copy = tokens;
+            });
+            flat.reset();
+            std::optional<ast> folded;
+            report.measure(kind.name, input.size(), "parse_ast", [&] {
+                folded = parse_ast(std::move(copy));
+            }, {{"tokens_per_second", count}}, [&] {
+                folded.reset();
+                copy = tokens;
+            });
+            auto json_mb = static_cast<double>(tree->to_json(-1).size()) / (1 << 20);
+            report.measure(kind.name, input.size(), "to_json", [&] {
+                tree->to_json(-1);
+            }, {{"mb_per_second", json_mb}, {"nodes_per_second", nodes}});
+            report.measure(kind.name, input.size(), "to_string", [&] {
+                tree->to_string();
+            }, {{"nodes_per_second", nodes}});
+            report.measure(kind.name, input.size(), "evaluate", [&] {
+                evaluate(*folded);
+            }, {{"tokens_per_second", count}});
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../server.h"
+
+using std::string;
+using std::vector;
+using clock_type = std::chrono::steady_clock;
+
+// Load generator for `parser --serve`: every connection keeps `depth` requests in flight
+// and records the time from sending a request to reading its answer.
+struct load_options {
+    string endpoint;
+    size_t connections = 4;
+    size_t requests = 10000;
+    size_t depth = 16;
+    framing frames = FRAMING_LINES;
+    string expression = "(12345 + 678) * 9 - (4321 - 8765 * (11 + 22)) + 3141592 * 2718 - (99 + 1) * (7 - 5) + 42";
+};
+
+struct connection_result {
+    vector<double> latencies;
+    size_t errors = 0;
+    string failure;
+};
+
+static string frame(load_options const &options) {
+    if (options.frames == FRAMING_LINES) {
+        return options.expression + "\n";
+    }
+    auto length = options.expression.size();
+    string res(4, '\0');
+    for (size_t i = 0; i < 4; ++i) {
+        res[i] = static_cast<char>(length >> (24 - 8 * i) & 0xFF);
+    }
+    return res + options.expression;
+}
+
+// Length of the first complete answer in buffer[pos..], or 0 if it isn't there yet.
+static size_t answer_length(string const &buffer, size_t pos, framing frames) {
+    if (frames == FRAMING_LINES) {
+        auto end = buffer.find('\n', pos);
+        return end == string::npos ? 0 : end + 1 - pos;
+    }
+    if (buffer.size() - pos < 4) {
+        return 0;
+    }
+    auto const *header = reinterpret_cast<unsigned char const *>(buffer.data() + pos);
+    size_t length = size_t(header[0]) << 24 | size_t(header[1]) << 16 | size_t(header[2]) << 8 | header[3];
+    return buffer.size() - pos - 4 < length ? 0 : length + 4;
+}
+
+static void run_connection(load_options const &options, connection_result &res) {
+    int fd = connect_endpoint(options.endpoint);
+    auto request = frame(options);
+    vector<clock_type::time_point> sent(options.requests);
+    res.latencies.reserve(options.requests);
+    string buffer;
+    vector<char> chunk(1 << 16);
+    size_t next = 0;
+    while (res.latencies.size() < options.requests) {
+        string batch;
+        for (; next < options.requests && next - res.latencies.size() < options.depth; ++next) {
+            batch.append(request);
+            sent[next] = clock_type::now();
+        }
+        for (size_t done = 0; done < batch.size();) {
+            auto got = ::send(fd, batch.data() + done, batch.size() - done, MSG_NOSIGNAL);
+            if (got < 0) {
+                ::close(fd);
+                throw std::runtime_error(string("send failed: ") + std::strerror(errno));
+            }
+            done += static_cast<size_t>(got);
+        }
+        auto got = ::read(fd, chunk.data(), chunk.size());
+        if (got <= 0) {
+            ::close(fd);
+            throw std::runtime_error("the server closed the connection");
+        }
+        auto now = clock_type::now();
+        buffer.append(chunk.data(), static_cast<size_t>(got));
+        size_t pos = 0;
+        for (size_t length; (length = answer_length(buffer, pos, options.frames)); pos += length) {
+            std::chrono::duration<double, std::micro> latency = now - sent[res.latencies.size()];
+            res.latencies.push_back(latency.count());
+            res.errors += std::string_view(buffer).substr(pos, length).find(",\"error\":") != std::string_view::npos;
+        }
+        buffer.erase(0, pos);
+    }
+    ::close(fd);
+}
+
+static double percentile(vector<double> const &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void print_usage() {
+    std::cerr << "Usage: parser_loadgen <unix_socket_path|:port> [--connections N] [--requests N_per_connection]"
+                 " [--depth N_in_flight] [--length-prefixed] [--expression text]\n";
+}
+
+int main(int argc, char *argv[]) {
+    load_options options;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--length-prefixed") {
+            options.frames = FRAMING_LENGTH;
+        } else if (arg[0] != '-') {
+            options.endpoint = arg;
+        } else if (i + 1 < argc && arg == "--connections") {
+            options.connections = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--requests") {
+            options.requests = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--depth") {
+            options.depth = std::max(1ul, std::stoul(argv[++i]));
+        } else if (i + 1 < argc && arg == "--expression") {
+            options.expression = argv[++i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    if (options.endpoint.empty()) {
+        print_usage();
+        return 1;
+    }
+    vector<connection_result> results(options.connections);
+    vector<std::thread> threads;
+    auto start = clock_type::now();
+    for (size_t i = 0; i < options.connections; ++i) {
+        threads.emplace_back([&options, &res = results[i]] {
+            try {
+                run_connection(options, res);
+            } catch (std::exception const &e) {
+                res.failure = e.what();
+            }
+        });
+    }
+    for (auto &item : threads) {
+        item.join();
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+    vector<double> latencies;
+    size_t errors = 0;
+    for (auto &res : results) {
+        if (!res.failure.empty()) {
+            std::cerr << res.failure << '\n';
+            return 1;
+        }
+        latencies.insert(latencies.end(), res.latencies.begin(), res.latencies.end());
+        errors += res.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "{\"connections\": " << options.connections << ", \"depth\": " << options.depth
+              << ", \"requests\": " << latencies.size() << ", \"errors\": " << errors
+              << ", \"seconds\": " << elapsed.count()
+              << ", \"requests_per_second\": " << static_cast<double>(latencies.size()) / elapsed.count()
+              << ", \"latency_us\": {\"p50\": " << percentile(latencies, 0.5)
+              << ", \"p99\": " << percentile(latencies, 0.99)
+              << ", \"max\": " << (latencies.empty() ? 0 : latencies.back()) << "}}\n";
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <ostream>
+#include "bigint.h"
+#include "digits.h"
+
+using std::vector;
+
+namespace {
+    using limbs_t = vector<uint32_t>;
+
+    constexpr size_t KARATSUBA_THRESHOLD = 32;
+
+    int compare(uint32_t const *a, size_t na, uint32_t const *b, size_t nb) {
+        if (na != nb) {
+            return na < nb ? -1 : 1;
+        }
+        for (size_t i = na; i-- > 0;) {
+            if (a[i] != b[i]) {
+                return a[i] < b[i] ? -1 : 1;
+            }
+        }
+        return 0;
+    }
+
+    void trim(limbs_t &x) {
+        while (!x.empty() && x.back() == 0) {
+            x.pop_back();
+        }
+    }
+
+    // res[offset..] += b; res must be long enough to absorb the carry.
+    void add_to(limbs_t &res, uint32_t const *b, size_t nb, size_t offset) {
+        uint32_t carry = 0;
+        size_t i = 0;
+        for (; i < nb || carry; ++i) {
+            uint32_t cur = res[offset + i] + carry + (i < nb ? b[i] : 0);
+            carry = cur >= bigint::BASE;
+            res[offset + i] = carry ? cur - bigint::BASE : cur;
+        }
+    }
+
+    // a -= b, requires a >= b.
+    void sub_from(limbs_t &a, limbs_t const &b) {
+        int64_t borrow = 0;
+        for (size_t i = 0; i < a.size() && (i < b.size() || borrow); ++i) {
+            int64_t cur = static_cast<int64_t>(a[i]) - borrow - (i < b.size() ? b[i] : 0);
+            borrow = cur < 0;
+            a[i] = static_cast<uint32_t>(borrow ? cur + bigint::BASE : cur);
+        }
+        trim(a);
+    }
+
+    limbs_t add(uint32_t const *a, size_t na, uint32_t const *b, size_t nb) {
+        if (na < nb) {
+            std::swap(a, b);
+            std::swap(na, nb);
+        }
+        limbs_t res(a, a + na);
+        res.push_back(0);
+        add_to(res, b, nb, 0);
+        trim(res);
+        return res;
+    }
+
+    void schoolbook(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *res) {
+        std::fill(res, res + na + nb, 0);
+        for (size_t i = 0; i < na; ++i) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < nb || carry; ++j) {
+                uint64_t cur = res[i + j] + carry + (j < nb ? static_cast<uint64_t>(a[i]) * b[j] : 0);
+                res[i + j] = static_cast<uint32_t>(cur % bigint::BASE);
+                carry = cur / bigint::BASE;
+            }
+        }
+    }
+
+    limbs_t multiply(uint32_t const *a, size_t na, uint32_t const *b, size_t nb);
+
+    // Karatsuba on operands of similar length: three half-size products instead of four.
+    limbs_t karatsuba(uint32_t const *a, size_t na, uint32_t const *b, size_t nb) {
+        size_t m = std::max(na, nb) / 2;
+        size_t na0 = std::min(na, m), nb0 = std::min(nb, m);
+        auto z0 = multiply(a, na0, b, nb0);
+        auto z2 = multiply(a + na0, na - na0, b + nb0, nb - nb0);
+        auto sa = add(a, na0, a + na0, na - na0);
+        auto sb = add(b, nb0, b + nb0, nb - nb0);
+        auto z1 = multiply(sa.data(), sa.size(), sb.data(), sb.size());
+        sub_from(z1, z0);
+        sub_from(z1, z2);
+        limbs_t res(na + nb + 1, 0);
+        add_to(res, z0.data(), z0.size(), 0);
+        add_to(res, z1.data(), z1.size(), m);
+        add_to(res, z2.data(), z2.size(), 2 * m);
+        trim(res);
+        return res;
+    }
+
+    limbs_t multiply(uint32_t const *a, size_t na, uint32_t const *b, size_t nb) {
+        while (na && !a[na - 1]) {
+            --na;
+        }
+        while (nb && !b[nb - 1]) {
+            --nb;
+        }
+        if (!na || !nb) {
+            return {};
+        }
+        if (na > nb) {
+            std::swap(a, b);
+            std::swap(na, nb);
+        }
+        limbs_t res;
+        if (na < KARATSUBA_THRESHOLD) {
+            res.resize(na + nb);
+            schoolbook(a, na, b, nb, res.data());
+        } else if (2 * na <= nb) {
+            // Unbalanced operands: multiply the short one by slices of the long one.
+            res.assign(na + nb + 1, 0);
+            for (size_t off = 0; off < nb; off += na) {
+                auto part = multiply(a, na, b + off, std::min(na, nb - off));
+                add_to(res, part.data(), part.size(), off);
+            }
+        } else {
+            return karatsuba(a, na, b, nb);
+        }
+        trim(res);
+        return res;
+    }
+}
+
+bigint::bigint(int64_t x) : negative(x < 0) {
+    auto mag = negative ? ~static_cast<uint64_t>(x) + 1 : static_cast<uint64_t>(x);
+    while (mag) {
+        limbs.push_back(static_cast<uint32_t>(mag % BASE));
+        mag /= BASE;
+    }
+}
+
+bigint::bigint(std::string_view digits) {
+    if (!digits.empty() && (digits[0] == '-' || digits[0] == '+')) {
+        negative = digits[0] == '-';
+        digits.remove_prefix(1);
+    }
+    limbs.resize(limb_count(digits.size()));
+    decode_limbs(digits.data(), digits.size(), limbs.data());
+    trim();
+}
+
+bigint::bigint(bool negative, std::vector<uint32_t> limbs) : negative(negative), limbs(std::move(limbs)) {
+    trim();
+}
+
+void bigint::trim() {
+    ::trim(limbs);
+    if (limbs.empty()) {
+        negative = false;
+    }
+}
+
+bool bigint::fits_int64() const {
+    static bigint const min(INT64_MIN);
+    static bigint const max(INT64_MAX);
+    auto const &bound = negative ? min.limbs : max.limbs;
+    return compare(limbs.data(), limbs.size(), bound.data(), bound.size()) <= 0;
+}
+
+int64_t bigint::to_int64() const {
+    uint64_t mag = 0;
+    for (size_t i = limbs.size(); i-- > 0;) {
+        mag = mag * BASE + limbs[i];
+    }
+    return static_cast<int64_t>(negative ? ~mag + 1 : mag);
+}
+
+std::string bigint::to_string() const {
+    if (limbs.empty()) {
+        return "0";
+    }
+    std::string res = negative ? "-" : "";
+    res.append(std::to_string(limbs.back()));
+    for (size_t i = limbs.size() - 1; i-- > 0;) {
+        auto part = std::to_string(limbs[i]);
+        res.append(BASE_DIGITS - part.size(), '0');
+        res.append(part);
+    }
+    return res;
+}
+
+bigint bigint::operator-() const {
+    bigint res = *this;
+    if (!res.limbs.empty()) {
+        res.negative = !res.negative;
+    }
+    return res;
+}
+
+bigint operator+(bigint const &a, bigint const &b) {
+    if (a.negative == b.negative) {
+        return bigint(a.negative, add(a.limbs.data(), a.limbs.size(), b.limbs.data(), b.limbs.size()));
+    }
+    if (compare(a.limbs.data(), a.limbs.size(), b.limbs.data(), b.limbs.size()) >= 0) {
+        auto res = a.limbs;
+        sub_from(res, b.limbs);
+        return bigint(a.negative, std::move(res));
+    }
+    auto res = b.limbs;
+    sub_from(res, a.limbs);
+    return bigint(b.negative, std::move(res));
+}
+
+bigint operator-(bigint const &a, bigint const &b) {
+    return a + (-b);
+}
+
+bigint operator*(bigint const &a, bigint const &b) {
+    return bigint(a.negative != b.negative, multiply(a.limbs.data(), a.limbs.size(), b.limbs.data(), b.limbs.size()));
+}
+
+bool operator==(bigint const &a, bigint const &b) {
+    return a.negative == b.negative && a.limbs == b.limbs;
+}
+
+bool operator!=(bigint const &a, bigint const &b) {
+    return !(a == b);
+}
+
+std::ostream &operator<<(std::ostream &os, bigint const &x) {
+    return os << x.to_string();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Signed arbitrary-precision integer: magnitude in base 10^9 limbs, least significant first.
+class bigint {
+    bool negative = false;
+    std::vector<uint32_t> limbs;
+
+    void trim();
+public:
+    static constexpr uint32_t BASE = 1000000000;
+    static constexpr size_t BASE_DIGITS = 9;
+
+    bigint() = default;
+    bigint(int64_t x);
+    explicit bigint(std::string_view digits);
+    bigint(bool negative, std::vector<uint32_t> limbs);
+
+    bool is_zero() const {
+        return limbs.empty();
+    }
+
+    bool is_negative() const {
+        return negative;
+    }
+
+    std::vector<uint32_t> const& data() const {
+        return limbs;
+    }
+
+    bool fits_int64() const;
+    int64_t to_int64() const;
+    std::string to_string() const;
+
+    bigint operator-() const;
+
+    friend bigint operator+(bigint const& a, bigint const& b);
+    friend bigint operator-(bigint const& a, bigint const& b);
+    friend bigint operator*(bigint const& a, bigint const& b);
+    friend bool operator==(bigint const& a, bigint const& b);
+};
+
+bool operator!=(bigint const& a, bigint const& b);
+std::ostream& operator<<(std::ostream& os, bigint const& x);
@@ -0,0 +1,142 @@
+#include <cstring>
+#include <vector>
+#include "binary_tree.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary tree format is little-endian only"
+#endif
+
+using namespace binary_format;
+
+void write_binary(node const &tree, std::ostream &out) {
+    std::vector<node const *> order{&tree};
+    uint64_t literal_size = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        if (order[i]->type == TERM) {
+            literal_size += order[i]->data->data.size();
+        }
+        for (auto &&item : order[i]->children) {
+            order.push_back(&item);
+        }
+    }
+    header head{};
+    std::memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    head.version = VERSION;
+    head.node_count = order.size();
+    head.literal_size = literal_size;
+    out.write(reinterpret_cast<char const *>(&head), sizeof(head));
+
+    std::vector<record> chunk;
+    chunk.reserve(4096);
+    uint64_t next_child = 1;
+    uint64_t next_literal = 0;
+    for (auto cur : order) {
+        record rec{};
+        rec.type = static_cast<uint8_t>(cur->type);
+        if (cur->type == TERM) {
+            rec.begin = next_literal;
+            rec.length = static_cast<uint32_t>(cur->data->data.size());
+            rec.token = static_cast<uint8_t>(cur->data->type);
+            next_literal += rec.length;
+        } else {
+            rec.begin = next_child;
+            rec.length = static_cast<uint32_t>(cur->children.size());
+            next_child += rec.length;
+        }
+        chunk.push_back(rec);
+        if (chunk.size() == chunk.capacity()) {
+            out.write(reinterpret_cast<char const *>(chunk.data()), chunk.size() * sizeof(record));
+            chunk.clear();
+        }
+    }
+    out.write(reinterpret_cast<char const *>(chunk.data()), chunk.size() * sizeof(record));
+    for (auto cur : order) {
+        if (cur->type == TERM) {
+            out.write(cur->data->data.data(), cur->data->data.size());
+        }
+    }
+}
+
+binary_tree_view::binary_tree_view(char const *data, size_t size) {
+    header head{};
+    if (size < sizeof(head)) {
+        throw binary_tree_exception("Binary tree is truncated: no header");
+    }
+    std::memcpy(&head, data, sizeof(head));
+    if (std::memcmp(head.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw binary_tree_exception("Not a binary parse tree");
+    }
+    if (head.version != VERSION) {
+        throw binary_tree_exception("Unsupported binary tree version " + std::to_string(head.version));
+    }
+    if (reinterpret_cast<uintptr_t>(data) % alignof(record) != 0) {
+        throw binary_tree_exception("Binary tree data is not 8-byte aligned");
+    }
+    auto available = size - sizeof(head);
+    if (head.node_count > available / sizeof(record)
+        || head.literal_size != available - head.node_count * sizeof(record)) {
+        throw binary_tree_exception("Binary tree size doesn't match its header");
+    }
+    nodes = reinterpret_cast<record const *>(data + sizeof(head));
+    literals = data + sizeof(head) + head.node_count * sizeof(record);
+    count = head.node_count;
+    literal_size = head.literal_size;
+}
+
+void binary_tree_view::validate() const {
+    uint64_t next_child = 1;
+    for (uint64_t i = 0; i < count; ++i) {
+        auto const &rec = nodes[i];
+        if (rec.type > EPS) {
+            throw binary_tree_exception("Invalid node type at record " + std::to_string(i));
+        }
+        if (rec.type == TERM) {
+            if (rec.token > END || rec.begin > literal_size || rec.length > literal_size - rec.begin) {
+                throw binary_tree_exception("Invalid literal at record " + std::to_string(i));
+            }
+        } else {
+            if (rec.begin != next_child || rec.length > count - next_child) {
+                throw binary_tree_exception("Invalid child range at record " + std::to_string(i));
+            }
+            next_child += rec.length;
+        }
+    }
+    if (count && next_child != count) {
+        throw binary_tree_exception("Binary tree has unreachable records");
+    }
+}
+
+node binary_tree_view::to_node() const {
+    validate();
+    if (!count) {
+        return node(EPS);
+    }
+    if (type(0) == TERM) {
+        return node(TERM, token{term_type(0), std::string(text(0))});
+    }
+    node res(type(0));
+    std::vector<std::pair<uint64_t, node *>> stack{{0, &res}};
+    while (!stack.empty()) {
+        auto [i, cur] = stack.back();
+        stack.pop_back();
+        auto cnt = child_count(i);
+        cur->children.reserve(cnt);
+        for (auto c = first_child(i); c < first_child(i) + cnt; ++c) {
+            switch (type(c)) {
+                case TERM: {
+                    cur->children.emplace_back(TERM, token{term_type(c), std::string(text(c))});
+                    break;
+                }
+                case EPS: {
+                    cur->children.emplace_back(EPS);
+                    break;
+                }
+                default: {
+                    stack.emplace_back(c, &cur->children.emplace_back(type(c)));
+                    break;
+                }
+            }
+        }
+    }
+    return res;
+}
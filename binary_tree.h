@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "parser.h"
+
+// Binary parse tree format, version 1, little-endian:
+//   header   magic "MTPT", version, reserved, node count, literal pool size
+//   nodes    node count records in breadth-first order, root first; the children
+//            of a node are the records [begin, begin + length)
+//   literals token texts; a TERM record points into the pool with [begin, begin + length)
+// The node table is 8-byte aligned so a mapped file can be read in place.
+class binary_tree_exception : public std::exception {
+    std::string reason;
+public:
+    const char *what() const noexcept override {
+        return reason.c_str();
+    }
+
+    explicit binary_tree_exception(std::string reason) : reason(std::move(reason)) {}
+};
+
+namespace binary_format {
+    constexpr char MAGIC[4] = {'M', 'T', 'P', 'T'};
+    constexpr uint32_t VERSION = 1;
+
+    struct header {
+        char magic[4];
+        uint32_t version;
+        uint64_t reserved;
+        uint64_t node_count;
+        uint64_t literal_size;
+    };
+
+    struct record {
+        uint64_t begin;
+        uint32_t length;
+        uint8_t type;
+        uint8_t token;
+        uint16_t reserved;
+    };
+
+    static_assert(sizeof(header) == 32 && sizeof(record) == 16, "binary tree layout changed");
+}
+
+void write_binary(node const &tree, std::ostream &out);
+
+// Zero-copy view over a serialized tree; the bytes must outlive the view. Only the
+// header is checked on construction, validate() checks every record.
+class binary_tree_view {
+    binary_format::record const *nodes = nullptr;
+    char const *literals = nullptr;
+    uint64_t count = 0;
+    uint64_t literal_size = 0;
+
+public:
+    binary_tree_view(char const *data, size_t size);
+
+    void validate() const;
+    node to_node() const;
+
+    uint64_t size() const {
+        return count;
+    }
+
+    node_type type(uint64_t i) const {
+        return static_cast<node_type>(nodes[i].type);
+    }
+
+    uint64_t first_child(uint64_t i) const {
+        return nodes[i].begin;
+    }
+
+    uint32_t child_count(uint64_t i) const {
+        return type(i) == TERM ? 0 : nodes[i].length;
+    }
+
+    token_type term_type(uint64_t i) const {
+        return static_cast<token_type>(nodes[i].token);
+    }
+
+    std::string_view text(uint64_t i) const {
+        return {literals + nodes[i].begin, nodes[i].length};
+    }
+};
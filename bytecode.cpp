@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include "bigint.h"
+#include "bytecode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BYTECODE_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define BYTECODE_CLONES
+#endif
+
+namespace {
+    // Four lanes per vector; the avx2 clone keeps each in one register.
+    using lane_vector = uint64_t __attribute__((vector_size(32)));
+
+    constexpr size_t VECTOR = sizeof(lane_vector) / sizeof(uint64_t);
+    constexpr size_t VECTORS = program::LANES / VECTOR;
+
+    // The vector type is only 16-byte aligned unless AVX is enabled for the whole file.
+    struct alignas(32) lane_register {
+        lane_vector v[VECTORS];
+    };
+}
+
+static_assert(program::LANES % VECTOR == 0, "LANES must be a whole number of vectors");
+
+// Runs the program over rows [begin, end) block by block, keeping the value stack in
+// regs. Unsigned lanes give wrap-around arithmetic.
+// The tail of a partial block holds stale values that are computed and never stored.
+BYTECODE_CLONES
+static void run_lanes(instruction const *code, size_t code_size, int64_t const *constants,
+                      int64_t const *const *columns, lane_register *regs, int64_t *out, size_t begin, size_t end) {
+    for (size_t row = begin; row < end; row += program::LANES) {
+        size_t count = std::min(program::LANES, end - row);
+        size_t top = 0;
+        for (size_t k = 0; k < code_size; ++k) {
+            auto const &cur = code[k];
+            switch (cur.op) {
+                case OP_CONST: {
+                    auto *dst = regs[top++].v;
+                    lane_vector value = lane_vector{} + static_cast<uint64_t>(constants[cur.arg]);
+                    for (size_t v = 0; v < VECTORS; ++v) {
+                        dst[v] = value;
+                    }
+                    break;
+                }
+                case OP_LOAD: {
+                    std::memcpy(regs[top++].v, columns[cur.arg] + row, count * sizeof(int64_t));
+                    break;
+                }
+                case OP_NEG: {
+                    auto *dst = regs[top - 1].v;
+                    for (size_t v = 0; v < VECTORS; ++v) {
+                        dst[v] = -dst[v];
+                    }
+                    break;
+                }
+                case OP_ADD: {
+                    --top;
+                    auto *dst = regs[top - 1].v;
+                    auto const *rhs = regs[top].v;
+                    for (size_t v = 0; v < VECTORS; ++v) {
+                        dst[v] += rhs[v];
+                    }
+                    break;
+                }
+                case OP_SUB: {
+                    --top;
+                    auto *dst = regs[top - 1].v;
+                    auto const *rhs = regs[top].v;
+                    for (size_t v = 0; v < VECTORS; ++v) {
+                        dst[v] -= rhs[v];
+                    }
+                    break;
+                }
+                case OP_MUL: {
+                    --top;
+                    auto *dst = regs[top - 1].v;
+                    auto const *rhs = regs[top].v;
+                    for (size_t v = 0; v < VECTORS; ++v) {
+                        dst[v] *= rhs[v];
+                    }
+                    break;
+                }
+            }
+        }
+        std::memcpy(out + row, regs, count * sizeof(int64_t));
+    }
+}
+
+static int64_t constant(token_buffer const &toks, size_t i) {
+    if (!toks.is_long(i)) {
+        if (toks.value(i) <= INT64_MAX) {
+            return static_cast<int64_t>(toks.value(i));
+        }
+    } else {
+        auto const *limbs = toks.limbs(i);
+        bigint value(false, std::vector<uint32_t>(limbs, limbs + limb_count(toks.text(i).size())));
+        if (value.fits_int64()) {
+            return value.to_int64();
+        }
+    }
+    throw std::out_of_range("Constant doesn't fit int64_t: " + std::string(toks.text(i)));
+}
+
+program compile(ast const &tree) {
+    program res;
+    std::unordered_map<std::string_view, uint32_t> index;
+    size_t top = 0;
+    // The nodes are in postorder, which is already the RPN order.
+    for (uint32_t i = 0; i < tree.size(); ++i) {
+        switch (tree[i].type) {
+            case ast_type::Num: {
+                res.code.push_back({OP_CONST, static_cast<uint32_t>(res.constants.size())});
+                res.constants.push_back(constant(tree.tokens(), tree[i].lhs));
+                ++top;
+                break;
+            }
+            case ast_type::Var: {
+                auto [it, inserted] = index.emplace(tree.text(i), static_cast<uint32_t>(res.names.size()));
+                if (inserted) {
+                    res.names.emplace_back(tree.text(i));
+                }
+                res.code.push_back({OP_LOAD, it->second});
+                ++top;
+                break;
+            }
+            case ast_type::Pos: {
+                break;
+            }
+            case ast_type::Neg: {
+                res.code.push_back({OP_NEG, 0});
+                break;
+            }
+            case ast_type::Add:
+            case ast_type::Sub:
+            case ast_type::Mul: {
+                auto op = tree[i].type == ast_type::Add ? OP_ADD : tree[i].type == ast_type::Sub ? OP_SUB : OP_MUL;
+                res.code.push_back({op, 0});
+                --top;
+                break;
+            }
+        }
+        res.depth = std::max(res.depth, top);
+    }
+    return res;
+}
+
+program compile(std::string const &expression) {
+    return compile(parse_ast(tokenize_buffer(expression)));
+}
+
+size_t program::variable(std::string_view name) const {
+    auto it = std::find(names.begin(), names.end(), name);
+    return it == names.end() ? NOT_FOUND : static_cast<size_t>(it - names.begin());
+}
+
+void program::run_blocks(int64_t const *const *columns, int64_t *out, size_t begin, size_t end) const {
+    std::vector<lane_register> regs(std::max<size_t>(depth, 1));
+    run_lanes(code.data(), code.size(), constants.data(), columns, regs.data(), out, begin, end);
+}
+
+static void check_columns(std::vector<int64_t const *> const &columns, size_t expected) {
+    if (columns.size() < expected) {
+        throw std::invalid_argument("Expected " + std::to_string(expected) + " columns, got "
+                                    + std::to_string(columns.size()));
+    }
+}
+
+void program::run(std::vector<int64_t const *> const &columns, int64_t *out, size_t rows) const {
+    check_columns(columns, names.size());
+    run_blocks(columns.data(), out, 0, rows);
+}
+
+void program::run(std::vector<int64_t const *> const &columns, int64_t *out, size_t rows, thread_pool &pool) const {
+    check_columns(columns, names.size());
+    size_t blocks = (rows + LANES - 1) / LANES;
+    size_t tasks = std::min(blocks, 4 * (pool.size() + 1));
+    task_group group(pool);
+    for (size_t i = 0; i < tasks; ++i) {
+        size_t begin = blocks * i / tasks * LANES;
+        size_t end = std::min(rows, blocks * (i + 1) / tasks * LANES);
+        group.run([this, &columns, out, begin, end] {
+            run_blocks(columns.data(), out, begin, end);
+        });
+    }
+    group.wait();
+}
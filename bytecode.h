@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ast.h"
+#include "thread_pool.h"
+
+enum opcode : uint8_t {
+    OP_CONST, OP_LOAD, OP_ADD, OP_SUB, OP_MUL, OP_NEG
+};
+
+struct instruction {
+    opcode op;
+    // Index into the constants for OP_CONST, into the variables for OP_LOAD.
+    uint32_t arg;
+};
+
+// Stack program of one expression, in RPN order. run() evaluates it for many rows of
+// variable bindings given as int64_t columns: rows are processed LANES at a time, each
+// instruction being one loop over SIMD vectors of the block, and blocks are spread over
+// a pool. Unlike evaluate(), arithmetic wraps around on 64-bit overflow.
+class program {
+    std::vector<instruction> code;
+    std::vector<int64_t> constants;
+    std::vector<std::string> names;
+    size_t depth = 0;
+
+    friend program compile(ast const& tree);
+
+    void run_blocks(int64_t const* const* columns, int64_t* out, size_t begin, size_t end) const;
+public:
+    static constexpr size_t LANES = 256;
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+    std::vector<instruction> const& instructions() const {
+        return code;
+    }
+
+    std::vector<int64_t> const& constant_pool() const {
+        return constants;
+    }
+
+    // Variables in order of first appearance; run() takes one column per variable.
+    std::vector<std::string> const& variables() const {
+        return names;
+    }
+
+    size_t variable(std::string_view name) const;
+
+    size_t stack_depth() const {
+        return depth;
+    }
+
+    // out[i] is the value for row i, with variable j bound to columns[j][i].
+    void run(std::vector<int64_t const*> const& columns, int64_t* out, size_t rows) const;
+    void run(std::vector<int64_t const*> const& columns, int64_t* out, size_t rows, thread_pool& pool) const;
+};
+
+// Throws std::out_of_range if a literal doesn't fit int64_t.
+program compile(ast const& tree);
+program compile(std::string const& expression);
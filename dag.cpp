@@ -0,0 +1,169 @@
+#include "dag.h"
+
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t combine(uint64_t seed, uint64_t value) {
+    return mix(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+static uint64_t text_hash(std::string_view text) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (char c : text) {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+    }
+    return mix(h);
+}
+
+static uint64_t literal_hash(token_type type, std::string_view text) {
+    return combine(text_hash(text), type);
+}
+
+// Stores value in the first free slot of an open-addressing table.
+static size_t place(std::vector<uint32_t> &slots, uint64_t hash, uint32_t value) {
+    auto mask = slots.size() - 1;
+    auto pos = hash & mask;
+    while (slots[pos] != node_dag::NONE) {
+        pos = (pos + 1) & mask;
+    }
+    slots[pos] = value;
+    return pos;
+}
+
+node_dag::node_dag() : slots(64, NONE), literal_slots(64, NONE) {}
+
+void node_dag::grow() {
+    slots.assign(slots.size() * 2, NONE);
+    for (id i = 0; i < nodes.size(); ++i) {
+        place(slots, nodes[i].hash, i);
+    }
+}
+
+uint32_t node_dag::intern_literal(token_type type, std::string_view text) {
+    auto h = literal_hash(type, text);
+    auto mask = literal_slots.size() - 1;
+    for (auto pos = h & mask; literal_slots[pos] != NONE; pos = (pos + 1) & mask) {
+        auto cur = literal_slots[pos];
+        if (literal_types[cur] == type && literals[cur] == text) {
+            return cur;
+        }
+    }
+    auto res = static_cast<uint32_t>(literals.size());
+    literals.emplace_back(text);
+    literal_types.push_back(static_cast<uint8_t>(type));
+    if (2 * literals.size() > literal_slots.size()) {
+        literal_slots.assign(literal_slots.size() * 2, NONE);
+        for (uint32_t i = 0; i < literals.size(); ++i) {
+            place(literal_slots, literal_hash(static_cast<token_type>(literal_types[i]), literals[i]), i);
+        }
+    } else {
+        place(literal_slots, h, res);
+    }
+    return res;
+}
+
+bool node_dag::same(entry const &e, node_type type, uint32_t literal, id const *children, size_t count) const {
+    if (e.type != type || e.literal != literal || e.count != count) {
+        return false;
+    }
+    for (size_t k = 0; k < count; ++k) {
+        if (child_ids[e.first + k] != children[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+node_dag::id node_dag::intern(node_type type, uint32_t literal, id const *children, size_t count) {
+    uint64_t h = mix(type + 1);
+    if (type == TERM) {
+        h = combine(h, literal_hash(static_cast<token_type>(literal_types[literal]), literals[literal]));
+    }
+    for (size_t k = 0; k < count; ++k) {
+        h = combine(h, nodes[children[k]].hash);
+    }
+    auto mask = slots.size() - 1;
+    auto pos = h & mask;
+    for (; slots[pos] != NONE; pos = (pos + 1) & mask) {
+        auto const &e = nodes[slots[pos]];
+        if (e.hash == h && same(e, type, literal, children, count)) {
+            return slots[pos];
+        }
+    }
+    auto res = static_cast<id>(nodes.size());
+    nodes.push_back({h, static_cast<uint32_t>(child_ids.size()), static_cast<uint32_t>(count), literal,
+                     static_cast<uint8_t>(type)});
+    child_ids.insert(child_ids.end(), children, children + count);
+    slots[pos] = res;
+    if (2 * nodes.size() > slots.size()) {
+        grow();
+    }
+    return res;
+}
+
+node_dag::id node_dag::intern_term(token_type type, std::string_view text) {
+    return intern(TERM, intern_literal(type, text), nullptr, 0);
+}
+
+node_dag::id node_dag::intern(node const &tree) {
+    // Postorder walk; the ids of finished children wait on a shared stack.
+    std::vector<std::pair<node const *, size_t>> stack{{&tree, 0}};
+    std::vector<id> done;
+    while (!stack.empty()) {
+        auto &[cur, next] = stack.back();
+        if (next < cur->children.size()) {
+            stack.emplace_back(&cur->children[next++], 0);
+            continue;
+        }
+        id res;
+        if (cur->type == TERM) {
+            res = intern_term(cur->data->type, cur->data->data);
+        } else {
+            auto count = cur->children.size();
+            res = intern(cur->type, NONE, done.data() + done.size() - count, count);
+            done.resize(done.size() - count);
+        }
+        done.push_back(res);
+        stack.pop_back();
+    }
+    return done.back();
+}
+
+uint64_t node_dag::tree_size(id i) const {
+    std::vector<uint64_t> sizes(i + 1);
+    for (id j = 0; j <= i; ++j) {
+        sizes[j] = 1;
+        for (size_t k = 0; k < nodes[j].count; ++k) {
+            sizes[j] += sizes[child_ids[nodes[j].first + k]];
+        }
+    }
+    return sizes[i];
+}
+
+node node_dag::to_node(id i) const {
+    if (type(i) == TERM) {
+        return node(TERM, token(term_type(i), std::string(text(i))));
+    }
+    node res(type(i));
+    std::vector<std::pair<id, node *>> stack{{i, &res}};
+    while (!stack.empty()) {
+        auto [cur, out] = stack.back();
+        stack.pop_back();
+        out->children.reserve(child_count(cur));
+        for (size_t k = 0; k < child_count(cur); ++k) {
+            auto c = child(cur, k);
+            if (type(c) == TERM) {
+                out->children.emplace_back(TERM, token(term_type(c), std::string(text(c))));
+            } else {
+                stack.emplace_back(c, &out->children.emplace_back(type(c)));
+            }
+        }
+    }
+    return res;
+}
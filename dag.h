@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lexer.h"
+#include "parser.h"
+
+// Parse trees with identical subtrees stored once. Every distinct subtree gets an id
+// and a Merkle-style hash over its type, literal and child hashes; interning the same
+// structure twice returns the same id, so equal subtrees of one dag compare by id.
+// Children are created before their parents, so ids are in topological order.
+// Shared nodes have no single position in the source, so a dag keeps no spans.
+class node_dag {
+public:
+    using id = uint32_t;
+    static constexpr id NONE = UINT32_MAX;
+
+private:
+    struct entry {
+        uint64_t hash;
+        uint32_t first;
+        uint32_t count;
+        uint32_t literal;
+        uint8_t type;
+    };
+
+    std::vector<entry> nodes;
+    std::vector<id> child_ids;
+    std::vector<std::string> literals;
+    std::vector<uint8_t> literal_types;
+    std::vector<id> slots;
+    std::vector<uint32_t> literal_slots;
+
+    void grow();
+    uint32_t intern_literal(token_type type, std::string_view text);
+    bool same(entry const &e, node_type type, uint32_t literal, id const *children, size_t count) const;
+
+public:
+    node_dag();
+
+    // Returns the id of the node with the given type, literal and children; literal is
+    // NONE for everything but TERM nodes, which come from intern_term().
+    id intern(node_type type, uint32_t literal, id const *children, size_t count);
+    id intern_term(token_type type, std::string_view text);
+    id intern(node const &tree);
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    node_type type(id i) const {
+        return static_cast<node_type>(nodes[i].type);
+    }
+
+    uint64_t hash(id i) const {
+        return nodes[i].hash;
+    }
+
+    size_t child_count(id i) const {
+        return nodes[i].count;
+    }
+
+    id child(id i, size_t k) const {
+        return child_ids[nodes[i].first + k];
+    }
+
+    token_type term_type(id i) const {
+        return static_cast<token_type>(literal_types[nodes[i].literal]);
+    }
+
+    std::string_view text(id i) const {
+        return literals[nodes[i].literal];
+    }
+
+    // Number of nodes of the tree the id stands for, with sharing undone.
+    uint64_t tree_size(id i) const;
+    node to_node(id i) const;
+};
+
+node_dag::id parse_dag(token_buffer const &data, node_dag &dag, parse_limits limits = parse_limits());
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Decoding of decimal digit runs, eight bytes at a time with SWAR multiplies. The lexer
+// decodes NUMBER literals while it scans them; bigint uses the same limb decoding.
+
+// Every literal of up to this many digits fits uint64_t.
+constexpr size_t SHORT_DIGITS = 19;
+constexpr size_t LIMB_DIGITS = 9;
+
+// Value of the eight ASCII digits at p, most significant first.
+inline uint32_t decode_eight_digits(char const *p) {
+    uint64_t chunk;
+    std::memcpy(&chunk, p, sizeof(chunk));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    chunk = __builtin_bswap64(chunk);
+#endif
+    // Combine adjacent digits, then pairs, then quadruples; each step works on all lanes.
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0F) * (10 * 256 + 1)) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FF) * (100 * 65536 + 1)) >> 16;
+    return static_cast<uint32_t>(((chunk & 0x0000FFFF0000FFFF) * (10000 * (uint64_t(1) << 32) + 1)) >> 32);
+}
+
+inline uint64_t decode_sixteen_digits(char const *p) {
+    return uint64_t(decode_eight_digits(p)) * 100000000 + decode_eight_digits(p + 8);
+}
+
+// Value of a run of at most SHORT_DIGITS digits.
+inline uint64_t decode_digits(char const *p, size_t n) {
+    uint64_t res = 0;
+    size_t i = 0;
+    if (n >= 16) {
+        res = decode_sixteen_digits(p);
+        i = 16;
+    } else if (n >= 8) {
+        res = decode_eight_digits(p);
+        i = 8;
+    }
+    for (; i < n; ++i) {
+        res = res * 10 + static_cast<uint32_t>(p[i] - '0');
+    }
+    return res;
+}
+
+inline size_t limb_count(size_t digits) {
+    return (digits + LIMB_DIGITS - 1) / LIMB_DIGITS;
+}
+
+// Writes the limb_count(n) base 10^9 limbs of a digit run to out, least significant
+// first. Leading zero limbs are kept.
+inline void decode_limbs(char const *p, size_t n, uint32_t *out) {
+    size_t end = n;
+    for (; end >= LIMB_DIGITS; end -= LIMB_DIGITS) {
+        char const *limb = p + end - LIMB_DIGITS;
+        *out++ = decode_eight_digits(limb) * 10 + static_cast<uint32_t>(limb[8] - '0');
+    }
+    if (end) {
+        *out = static_cast<uint32_t>(decode_digits(p, end));
+    }
+}
@@ -0,0 +1,426 @@
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include "eval.h"
+
+namespace {
+    class number {
+        int64_t small = 0;
+        std::optional<bigint> big;
+
+        bigint wide() const {
+            return big ? *big : bigint(small);
+        }
+
+        static number from(bigint x) {
+            number res;
+            if (x.fits_int64()) {
+                res.small = x.to_int64();
+            } else {
+                res.big = std::move(x);
+            }
+            return res;
+        }
+    public:
+        number() = default;
+
+        explicit number(int64_t x) : small(x) {}
+
+        // A literal as decoded by the lexer: limbs if there are any, value otherwise.
+        static number literal(uint64_t value, uint32_t const *limbs, size_t count) {
+            if (count) {
+                return from(bigint(false, std::vector<uint32_t>(limbs, limbs + count)));
+            }
+            if (value <= INT64_MAX) {
+                return number(static_cast<int64_t>(value));
+            }
+            return from(bigint(false, {static_cast<uint32_t>(value % bigint::BASE),
+                                       static_cast<uint32_t>(value / bigint::BASE % bigint::BASE),
+                                       static_cast<uint32_t>(value / bigint::BASE / bigint::BASE)}));
+        }
+
+        static number literal(token const &tok) {
+            return literal(tok.value, tok.limbs.data(), tok.limbs.size());
+        }
+
+        static number literal(token_buffer const &toks, size_t i) {
+            if (toks.is_long(i)) {
+                return literal(0, toks.limbs(i), limb_count(toks.text(i).size()));
+            }
+            return literal(toks.value(i), nullptr, 0);
+        }
+
+        bigint get() const {
+            return wide();
+        }
+
+        friend number operator+(number const &a, number const &b) {
+            int64_t res;
+            if (!a.big && !b.big && !__builtin_add_overflow(a.small, b.small, &res)) {
+                return number(res);
+            }
+            return from(a.wide() + b.wide());
+        }
+
+        friend number operator-(number const &a, number const &b) {
+            int64_t res;
+            if (!a.big && !b.big && !__builtin_sub_overflow(a.small, b.small, &res)) {
+                return number(res);
+            }
+            return from(a.wide() - b.wide());
+        }
+
+        friend number operator*(number const &a, number const &b) {
+            int64_t res;
+            if (!a.big && !b.big && !__builtin_mul_overflow(a.small, b.small, &res)) {
+                return number(res);
+            }
+            return from(a.wide() * b.wide());
+        }
+
+        number operator-() const {
+            return number(0) - *this;
+        }
+    };
+
+    number pop(std::vector<number> &values) {
+        auto res = std::move(values.back());
+        values.pop_back();
+        return res;
+    }
+}
+
+[[noreturn]] static void unbound_variable(std::string_view name) {
+    throw std::invalid_argument("Unbound variable " + std::string(name));
+}
+
+namespace {
+    // The stacks of one walk, kept to be reused by the next.
+    struct walk_buffers {
+        std::vector<std::pair<node const *, bool>> stack;
+        std::vector<number> values;
+    };
+}
+
+static std::optional<number> evaluate_number(node const &tree, size_t budget, walk_buffers &buffers);
+
+static std::optional<number> evaluate_number(node const &tree, size_t budget = SIZE_MAX) {
+    walk_buffers buffers;
+    return evaluate_number(tree, budget, buffers);
+}
+
+// Postorder walk with an explicit stack. Each X contributes +/-T plus the rest of its
+// chain and each Y contributes F times the rest of its chain; since the arithmetic is
+// exact, this equals the left-associative fold of the grammar.
+bigint evaluate(node const &tree) {
+    return evaluate_number(tree)->get();
+}
+
+// Gives up and returns nothing once more than budget nodes have been visited.
+static std::optional<number> evaluate_number(node const &tree, size_t budget, walk_buffers &buffers) {
+    auto &stack = buffers.stack;
+    auto &values = buffers.values;
+    stack.assign({{&tree, false}});
+    values.clear();
+    while (!stack.empty()) {
+        auto [cur, visited] = stack.back();
+        stack.pop_back();
+        if (!visited) {
+            if (budget-- == 0) {
+                return std::nullopt;
+            }
+            stack.emplace_back(cur, true);
+            for (auto it = cur->children.rbegin(); it != cur->children.rend(); ++it) {
+                if (it->type != TERM && it->type != EPS) {
+                    stack.emplace_back(&*it, false);
+                }
+            }
+            continue;
+        }
+        auto const &first = cur->children.front();
+        switch (cur->type) {
+            case E:
+            case T: {
+                auto rest = pop(values);
+                auto head = pop(values);
+                values.push_back(cur->type == E ? head + rest : head * rest);
+                break;
+            }
+            case X: {
+                if (first.type == EPS) {
+                    values.emplace_back(0);
+                    break;
+                }
+                auto rest = pop(values);
+                auto term = pop(values);
+                values.push_back(first.data->type == MINUS ? rest - term : rest + term);
+                break;
+            }
+            case Y: {
+                if (first.type == EPS) {
+                    values.emplace_back(1);
+                    break;
+                }
+                auto rest = pop(values);
+                auto factor = pop(values);
+                values.push_back(factor * rest);
+                break;
+            }
+            case F: {
+                if (first.data->type == NUMBER) {
+                    values.push_back(number::literal(*first.data));
+                } else if (first.data->type == IDENTIFIER) {
+                    unbound_variable(first.data->data);
+                } else if (first.data->type == MINUS) {
+                    values.push_back(-pop(values));
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    }
+    return std::move(values.back());
+}
+
+bigint evaluate(ast const &tree) {
+    std::vector<number> values;
+    for (uint32_t i = 0; i < tree.size(); ++i) {
+        switch (tree[i].type) {
+            case ast_type::Num: {
+                values.push_back(number::literal(tree.tokens(), tree[i].lhs));
+                break;
+            }
+            case ast_type::Var: {
+                unbound_variable(tree.text(i));
+            }
+            case ast_type::Neg: {
+                values.back() = -values.back();
+                break;
+            }
+            case ast_type::Pos: {
+                break;
+            }
+            default: {
+                auto rhs = pop(values);
+                auto lhs = pop(values);
+                switch (tree[i].type) {
+                    case ast_type::Add: {
+                        values.push_back(lhs + rhs);
+                        break;
+                    }
+                    case ast_type::Sub: {
+                        values.push_back(lhs - rhs);
+                        break;
+                    }
+                    default: {
+                        values.push_back(lhs * rhs);
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+    }
+    return values.back().get();
+}
+
+namespace {
+    bool is_chain(node const *cur) {
+        return (cur->type == E || cur->type == T) && cur->children[1].children.size() == 3;
+    }
+
+    // Cuts the tree, by subtree size, into X and Y chains evaluated as separate groups:
+    // an operand of at least grain nodes becomes a group of its own once its parentheses
+    // and signs are peeled, and runs of smaller operands of about grain nodes in total are
+    // evaluated as one task each. Planning and combining use work lists, not recursion.
+    class parallel_evaluator {
+        static constexpr size_t NONE = SIZE_MAX;
+
+        // A node and its preorder index.
+        struct located {
+            node const *cur;
+            size_t index;
+        };
+
+        struct operand {
+            bool minus;
+            located at;
+        };
+
+        // Operands [begin, end) of a group evaluated sequentially, or the group child that
+        // stands for operand begin.
+        struct segment {
+            size_t begin;
+            size_t end;
+            size_t child;
+            number value;
+        };
+
+        struct group {
+            bool product;
+            bool negate;
+            std::vector<operand> operands;
+            std::vector<segment> segments;
+            number value;
+        };
+
+        thread_pool &pool;
+        size_t grain;
+        // Subtree sizes in preorder; a child's index follows from its elder siblings' sizes.
+        std::vector<size_t> sizes;
+        // Children come after their parents.
+        std::vector<group> groups;
+
+        void measure(node const &tree) {
+            struct frame {
+                node const *cur;
+                size_t index;
+                size_t next;
+            };
+            std::vector<frame> stack{{&tree, 0, 0}};
+            sizes.assign(1, 0);
+            while (!stack.empty()) {
+                auto &top = stack.back();
+                if (top.next == top.cur->children.size()) {
+                    sizes[top.index] = sizes.size() - top.index;
+                    stack.pop_back();
+                    continue;
+                }
+                auto const &item = top.cur->children[top.next++];
+                if (item.children.empty()) {
+                    sizes.push_back(1);
+                } else {
+                    stack.push_back({&item, sizes.size(), 0});
+                    sizes.push_back(0);
+                }
+            }
+        }
+
+        located child(located at, size_t i) const {
+            auto index = at.index + 1;
+            for (size_t j = 0; j < i; ++j) {
+                index += sizes[index];
+            }
+            return {&at.cur->children[i], index};
+        }
+
+        // Strips parentheses, unary signs and single-operand chains down to the first X or
+        // Y chain, or to a NUMBER or IDENTIFIER factor.
+        located peel(located at, bool &negate) const {
+            while (true) {
+                auto cur = at.cur;
+                if ((cur->type == E || cur->type == T) && !is_chain(cur)) {
+                    at = child(at, 0);
+                } else if (cur->type == F && cur->children.size() == 2) {
+                    negate ^= cur->children[0].data->type == MINUS;
+                    at = child(at, 1);
+                } else if (cur->type == F && cur->children.size() == 3) {
+                    at = child(at, 1);
+                } else {
+                    return at;
+                }
+            }
+        }
+
+        size_t add_group(located chain, bool negate) {
+            group res{chain.cur->type == T, negate, {{false, child(chain, 0)}}, {}, {}};
+            for (auto rest = child(chain, 1); rest.cur->children.size() == 3; rest = child(rest, 2)) {
+                res.operands.push_back({rest.cur->children[0].data->type == MINUS, child(rest, 1)});
+            }
+            groups.push_back(std::move(res));
+            return groups.size() - 1;
+        }
+
+        void split(size_t g) {
+            size_t run_begin = 0;
+            size_t run_size = 0;
+            auto close_run = [&](size_t end) {
+                if (run_begin < end) {
+                    groups[g].segments.push_back({run_begin, end, NONE, {}});
+                }
+                run_begin = end;
+                run_size = 0;
+            };
+            for (size_t i = 0; i < groups[g].operands.size(); ++i) {
+                auto at = groups[g].operands[i].at;
+                auto size = sizes[at.index];
+                if (size < grain) {
+                    run_size += size;
+                    if (run_size >= grain) {
+                        close_run(i + 1);
+                    }
+                    continue;
+                }
+                close_run(i);
+                bool negate = false;
+                auto inner = peel(at, negate);
+                size_t sub = is_chain(inner.cur) ? add_group(inner, negate) : NONE;
+                groups[g].segments.push_back({i, i + 1, sub, {}});
+                run_begin = i + 1;
+            }
+            close_run(groups[g].operands.size());
+        }
+
+        static number combine(group const &grp, number const &a, number const &b, bool minus) {
+            return grp.product ? a * b : minus ? a - b : a + b;
+        }
+
+    public:
+        parallel_evaluator(thread_pool &pool, size_t grain) : pool(pool), grain(std::max<size_t>(grain, 1)) {}
+
+        number evaluate(node const &tree) {
+            measure(tree);
+            bool negate = false;
+            auto chain = peel({&tree, 0}, negate);
+            if (!is_chain(chain.cur)) {
+                return *evaluate_number(tree);
+            }
+            add_group(chain, negate);
+            for (size_t g = 0; g < groups.size(); ++g) {
+                split(g);
+            }
+            {
+                task_group tasks(pool);
+                for (auto &grp : groups) {
+                    for (auto &seg : grp.segments) {
+                        if (seg.child != NONE) {
+                            continue;
+                        }
+                        tasks.run([&grp, &seg] {
+                            walk_buffers buffers;
+                            number res(grp.product ? 1 : 0);
+                            for (size_t i = seg.begin; i < seg.end; ++i) {
+                                auto const &item = grp.operands[i];
+                                res = combine(grp, res, *evaluate_number(*item.at.cur, SIZE_MAX, buffers), item.minus);
+                            }
+                            seg.value = std::move(res);
+                        });
+                    }
+                }
+                tasks.wait();
+            }
+            for (size_t g = groups.size(); g-- > 0;) {
+                auto &grp = groups[g];
+                number res(grp.product ? 1 : 0);
+                for (auto &seg : grp.segments) {
+                    if (seg.child == NONE) {
+                        res = combine(grp, res, seg.value, false);
+                    } else {
+                        res = combine(grp, res, groups[seg.child].value, grp.operands[seg.begin].minus);
+                    }
+                }
+                grp.value = grp.negate ? -res : res;
+            }
+            return std::move(groups[0].value);
+        }
+    };
+}
+
+bigint evaluate_parallel(node const &tree, thread_pool &pool, size_t grain) {
+    if (auto res = evaluate_number(tree, grain)) {
+        return res->get();
+    }
+    return parallel_evaluator(pool, grain).evaluate(tree).get();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "bigint.h"
+#include "parser.h"
+#include "ast.h"
+#include "thread_pool.h"
+
+// Exact value of an expression tree. Machine-word arithmetic is used until a
+// result overflows int64_t, after which the computation continues on bigint.
+// Throws std::invalid_argument on identifiers; see bytecode.h for evaluating with
+// variable bindings.
+bigint evaluate(node const& tree);
+bigint evaluate(ast const& tree);
+
+// Evaluates independent subtrees on the pool, chosen by size: the T operands of X
+// chains, the F operands of Y chains and the parenthesized groups inside operands of
+// at least grain nodes, in runs of about grain nodes. Nesting depth costs no native
+// stack. Trees of at most grain nodes are evaluated sequentially as a whole.
+bigint evaluate_parallel(node const& tree, thread_pool& pool, size_t grain = 1 << 14);
@@ -0,0 +1,165 @@
+#include <cstring>
+#include "json_writer.h"
+#include "parser.h"
+#include "stats.h"
+
+flat_tree::flat_tree(token_buffer tokens) : toks(std::move(tokens)) {
+    // Every token yields at most five nodes of the E/X/T/Y/F grammar, plus the root chain.
+    allocate(5 * toks.size() + 6);
+}
+
+void flat_tree::reset(token_buffer tokens) {
+    toks = std::move(tokens);
+    count = 0;
+    if (capacity < 5 * toks.size() + 6) {
+        allocate(5 * toks.size() + 6);
+    }
+}
+
+token_buffer flat_tree::release_tokens() {
+    count = 0;
+    return std::move(toks);
+}
+
+void flat_tree::allocate(size_t cap) {
+    std::unique_ptr<unsigned char[]> block(new unsigned char[cap * (3 * sizeof(uint32_t) + 1)]);
+    auto *new_first = reinterpret_cast<uint32_t *>(block.get());
+    auto *new_next = new_first + cap;
+    auto *new_tok = new_next + cap;
+    auto *new_types = reinterpret_cast<uint8_t *>(new_tok + cap);
+    if (count) {
+        std::memcpy(new_first, first, count * sizeof(uint32_t));
+        std::memcpy(new_next, next, count * sizeof(uint32_t));
+        std::memcpy(new_tok, tok, count * sizeof(uint32_t));
+        std::memcpy(new_types, types, count);
+    }
+    arena = std::move(block);
+    first = new_first;
+    next = new_next;
+    tok = new_tok;
+    types = new_types;
+    capacity = cap;
+}
+
+uint32_t flat_tree::add(node_type type, uint32_t token, uint32_t parent, uint32_t prev_sibling) {
+    if (count == capacity) {
+        allocate(2 * capacity);
+    }
+    auto cur = static_cast<uint32_t>(count++);
+    types[cur] = static_cast<uint8_t>(type);
+    first[cur] = NONE;
+    next[cur] = NONE;
+    tok[cur] = token;
+    if (prev_sibling != NONE) {
+        next[prev_sibling] = cur;
+    } else if (parent != NONE) {
+        first[parent] = cur;
+    }
+    return cur;
+}
+
+std::string flat_tree::to_json(int indent) const {
+    std::string res;
+    to_json(res, indent);
+    return res;
+}
+
+void flat_tree::to_json(std::string &res, int indent) const {
+    PARSER_STATS_PHASE(PHASE_SERIALIZE);
+    json_writer out(res, indent);
+    std::vector<uint32_t> stack;
+    auto open = [&](uint32_t i) {
+        switch (type(i)) {
+            case EPS: {
+                out.value(::to_string(EPS));
+                break;
+            }
+            case TERM: {
+                out.value(text(i));
+                break;
+            }
+            default: {
+                out.begin_node(::to_string(type(i)));
+                stack.push_back(first[i]);
+                break;
+            }
+        }
+    };
+    if (count) {
+        open(0);
+    }
+    while (!stack.empty()) {
+        auto child = stack.back();
+        if (child == NONE) {
+            out.end_node();
+            stack.pop_back();
+        } else {
+            stack.back() = next[child];
+            open(child);
+        }
+    }
+}
+
+std::string flat_tree::to_string() const {
+    std::string res;
+    for (size_t i = 0; i < count; ++i) {
+        if (types[i] == TERM) {
+            res.append(text(static_cast<uint32_t>(i)));
+        }
+    }
+    return res;
+}
+
+node flat_tree::to_node() const {
+    node res(count ? type(0) : EPS);
+    std::vector<std::pair<uint32_t, node *>> stack;
+    if (count) {
+        stack.emplace_back(0, &res);
+    }
+    while (!stack.empty()) {
+        auto [i, cur] = stack.back();
+        stack.pop_back();
+        size_t cnt = 0;
+        for (auto c = first[i]; c != NONE; c = next[c]) {
+            ++cnt;
+        }
+        cur->children.reserve(cnt);
+        for (auto c = first[i]; c != NONE; c = next[c]) {
+            switch (type(c)) {
+                case TERM: {
+                    cur->children.emplace_back(TERM, toks.at(tok[c]));
+                    break;
+                }
+                case EPS: {
+                    cur->children.emplace_back(EPS);
+                    break;
+                }
+                default: {
+                    stack.emplace_back(c, &cur->children.emplace_back(type(c)));
+                    break;
+                }
+            }
+        }
+    }
+    return res;
+}
+
+bool operator==(flat_tree const &a, flat_tree const &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (uint32_t i = 0; i < a.size(); ++i) {
+        if (a.type(i) != b.type(i) || a.first_child(i) != b.first_child(i) || a.next_sibling(i) != b.next_sibling(i)) {
+            return false;
+        }
+        if (a.type(i) == TERM && (a.tokens().type(a.token_index(i)) != b.tokens().type(b.token_index(i))
+                                  || a.text(i) != b.text(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool operator!=(flat_tree const &a, flat_tree const &b) {
+    return !(a == b);
+}
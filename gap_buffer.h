@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Text with a gap at the position of the last edit: an edit moves only the bytes between
+// it and the previous one, and grows the storage geometrically when the gap runs out.
+class gap_buffer {
+    std::vector<char> chars;
+    size_t gap_begin = 0;
+    size_t gap_end = 0;
+
+    void move_gap(size_t pos) {
+        if (pos < gap_begin) {
+            std::memmove(chars.data() + gap_end - (gap_begin - pos), chars.data() + pos, gap_begin - pos);
+        } else if (pos > gap_begin) {
+            std::memmove(chars.data() + gap_begin, chars.data() + gap_end, pos - gap_begin);
+        }
+        gap_end = gap_end - gap_begin + pos;
+        gap_begin = pos;
+    }
+
+    void reserve_gap(size_t n) {
+        if (gap_end - gap_begin >= n) {
+            return;
+        }
+        auto tail = chars.size() - gap_end;
+        auto capacity = std::max(2 * chars.size(), size() + n + 64);
+        chars.resize(capacity);
+        std::memmove(chars.data() + capacity - tail, chars.data() + gap_end, tail);
+        gap_end = capacity - tail;
+    }
+
+public:
+    explicit gap_buffer(std::string_view text = {}) : chars(text.begin(), text.end()), gap_begin(text.size()),
+                                                      gap_end(text.size()) {}
+
+    size_t size() const {
+        return chars.size() - (gap_end - gap_begin);
+    }
+
+    char operator[](size_t i) const {
+        return chars[i < gap_begin ? i : i + (gap_end - gap_begin)];
+    }
+
+    // Replaces [pos, pos + removed) with inserted.
+    void replace(size_t pos, size_t removed, std::string_view inserted) {
+        move_gap(pos);
+        gap_end += removed;
+        reserve_gap(inserted.size());
+        std::memcpy(chars.data() + gap_begin, inserted.data(), inserted.size());
+        gap_begin += inserted.size();
+    }
+
+    std::string substr(size_t pos, size_t n) const {
+        std::string res;
+        res.reserve(n);
+        if (pos < gap_begin) {
+            auto head = std::min(n, gap_begin - pos);
+            res.append(chars.data() + pos, head);
+            pos += head;
+            n -= head;
+        }
+        res.append(chars.data() + pos + (gap_end - gap_begin), n);
+        return res;
+    }
+
+    std::string str() const {
+        return substr(0, size());
+    }
+};
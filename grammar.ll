@@ -0,0 +1,8 @@
+# LL(1) grammar of the parser, see README.md.
+# Nonterminals are node_type names, terminals are token_type names, EPS is the empty string.
+# The first rule is the start symbol; END is appended to its FOLLOW set.
+E -> T X
+X -> PLUS T X | MINUS T X | EPS
+T -> F Y
+Y -> MUL F Y | EPS
+F -> MINUS F | PLUS F | NUMBER | IDENTIFIER | LEFT_PARENTHESIS E RIGHT_PARENTHESIS
@@ -0,0 +1,130 @@
+#include "json_writer.h"
+
+static constexpr size_t SPILL_SIZE = 1 << 16;
+
+void append_json_string(std::string &out, std::string_view s) {
+    static constexpr char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : s) {
+        switch (c) {
+            case '"': {
+                out.append("\\\"");
+                break;
+            }
+            case '\\': {
+                out.append("\\\\");
+                break;
+            }
+            case '\n': {
+                out.append("\\n");
+                break;
+            }
+            case '\t': {
+                out.append("\\t");
+                break;
+            }
+            case '\r': {
+                out.append("\\r");
+                break;
+            }
+            case '\b': {
+                out.append("\\b");
+                break;
+            }
+            case '\f': {
+                out.append("\\f");
+                break;
+            }
+            default: {
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(hex[(c >> 4) & 0xF]);
+                    out.push_back(hex[c & 0xF]);
+                } else {
+                    out.push_back(c);
+                }
+            }
+        }
+    }
+    out.push_back('"');
+}
+
+json_writer::json_writer(std::string &out, int indent) : buf(out), indent(indent) {}
+
+json_writer::json_writer(std::ostream &out, int indent) : buf(own), stream(&out), indent(indent) {
+    own.reserve(SPILL_SIZE + 256);
+}
+
+json_writer::~json_writer() {
+    flush();
+}
+
+void json_writer::new_line(size_t at) {
+    if (indent >= 0) {
+        buf.push_back('\n');
+        buf.append(at * indent, ' ');
+    }
+}
+
+void json_writer::element() {
+    if (need_comma) {
+        buf.push_back(',');
+    }
+    if (depth) {
+        new_line(level);
+    }
+}
+
+void json_writer::spill() {
+    if (stream && buf.size() >= SPILL_SIZE) {
+        flush();
+    }
+}
+
+void json_writer::begin_node(std::string_view type) {
+    element();
+    buf.push_back('{');
+    new_line(level + 1);
+    append_json_string(buf, type);
+    buf.append(indent >= 0 ? ": [" : ":[");
+    level += 2;
+    ++depth;
+    need_comma = false;
+}
+
+void json_writer::end_node() {
+    level -= 2;
+    --depth;
+    new_line(level + 1);
+    buf.push_back(']');
+    new_line(level);
+    buf.push_back('}');
+    need_comma = true;
+    spill();
+}
+
+void json_writer::empty_node(std::string_view type) {
+    element();
+    buf.push_back('{');
+    new_line(level + 1);
+    append_json_string(buf, type);
+    buf.append(indent >= 0 ? ": null" : ":null");
+    new_line(level);
+    buf.push_back('}');
+    need_comma = true;
+    spill();
+}
+
+void json_writer::value(std::string_view s) {
+    element();
+    append_json_string(buf, s);
+    need_comma = true;
+    spill();
+}
+
+void json_writer::flush() {
+    if (stream) {
+        stream->write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        buf.clear();
+    }
+}
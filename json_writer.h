@@ -0,0 +1,38 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+
+// Writes parse trees as JSON straight into a string or a stream. Every tree node is
+// emitted as {"<type>": [children...]} and leaves as strings; the layout matches
+// nlohmann::json::dump(indent), and a negative indent gives the compact form.
+class json_writer {
+    std::string own;
+    std::string &buf;
+    std::ostream *stream = nullptr;
+    int indent;
+    size_t level = 0;
+    size_t depth = 0;
+    bool need_comma = false;
+
+    void new_line(size_t at);
+    void element();
+    void spill();
+
+public:
+    json_writer(std::string &out, int indent = -1);
+    json_writer(std::ostream &out, int indent = -1);
+    json_writer(json_writer const &) = delete;
+    json_writer &operator=(json_writer const &) = delete;
+    ~json_writer();
+
+    void begin_node(std::string_view type);
+    void end_node();
+    // A node without children, written as {"<type>": null}.
+    void empty_node(std::string_view type);
+    void value(std::string_view s);
+    void flush();
+};
+
+void append_json_string(std::string &out, std::string_view s);
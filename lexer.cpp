@@ -1,6 +1,14 @@
+#include <algorithm>
 #include <cctype>
-#include <sstream>
+#include <cstring>
+#include <iterator>
 #include "lexer.h"
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LEXER_X86
+#include <immintrin.h>
+#endif
 
 using std::vector;
 using std::string;
@@ -10,63 +18,406 @@ static bool my_isspace(char ch) {
     return std::isspace(static_cast<unsigned char>(ch));
 }
 
-vector<token> tokenize(istream &in) {
-    string buff;
-    vector<token> res;
-    auto check = [&buff, &res]() {
-        if (!buff.empty()) {
-            res.emplace_back(NUMBER, buff);
-            buff.clear();
-        }
-    };
-    int x;
-    while ((x = in.get()) != istream::traits_type::eof()) {
-        char c = static_cast<char>(x);
+static bool is_digit(char ch) {
+    return '0' <= ch && ch <= '9';
+}
+
+// Identifiers are [A-Za-z_][A-Za-z0-9_]*; digits right before a letter end a number.
+static bool is_ident_start(char ch) {
+    return ('a' <= (ch | 0x20) && (ch | 0x20) <= 'z') || ch == '_';
+}
+
+static bool is_ident_char(char ch) {
+    return is_ident_start(ch) || is_digit(ch);
+}
+
+static void lex(token_buffer &res) {
+    std::string_view src = res.source();
+    size_t i = 0;
+    while (i < src.size()) {
+        char c = src[i];
         if (my_isspace(c)) {
-            check();
+            ++i;
             continue;
         }
-        if ('0' <= c && c <= '9') {
-            buff.push_back(c);
+        if (is_digit(c) || is_ident_start(c)) {
+            size_t start = i;
+            auto type = is_digit(c) ? NUMBER : IDENTIFIER;
+            auto inside = type == NUMBER ? is_digit : is_ident_char;
+            while (i < src.size() && inside(src[i])) {
+                ++i;
+            }
+            res.push_back(type, start, i - start);
             continue;
         }
         switch (c) {
             case '+': {
-                check();
-                res.emplace_back(PLUS, "+");
+                res.push_back(PLUS, i, 1);
                 break;
             }
             case '-': {
-                check();
-                res.emplace_back(MINUS, "-");
+                res.push_back(MINUS, i, 1);
                 break;
             }
             case '*': {
-                check();
-                res.emplace_back(MUL, "*");
+                res.push_back(MUL, i, 1);
                 break;
             }
             case '(': {
-                check();
-                res.emplace_back(LEFT_PARENTHESIS, "(");
+                res.push_back(LEFT_PARENTHESIS, i, 1);
                 break;
             }
             case ')': {
-                check();
-                res.emplace_back(RIGHT_PARENTHESIS, ")");
+                res.push_back(RIGHT_PARENTHESIS, i, 1);
                 break;
             }
             default: {
-                throw lexer_exception(in);
+                throw lexer_exception(src, res.locate(i, 1));
             }
         }
+        ++i;
+    }
+    res.push_back(END, src.size(), 0);
+}
+
+namespace {
+    // Per-byte classification of a 64-byte block, one bit per byte.
+    struct block_masks {
+        uint64_t digit;
+        uint64_t alpha;
+        uint64_t op;
+        uint64_t invalid;
+    };
+
+    using classify_fn = block_masks (*)(char const *p);
+
+    constexpr size_t BLOCK = 64;
+
+    struct op_table {
+        uint8_t type[256];
+
+        constexpr op_table() : type() {
+            for (auto &x : type) {
+                x = END;
+            }
+            type[static_cast<uint8_t>('+')] = PLUS;
+            type[static_cast<uint8_t>('-')] = MINUS;
+            type[static_cast<uint8_t>('*')] = MUL;
+            type[static_cast<uint8_t>('(')] = LEFT_PARENTHESIS;
+            type[static_cast<uint8_t>(')')] = RIGHT_PARENTHESIS;
+        }
+    };
+
+    constexpr op_table ops;
+}
+
+#ifdef LEXER_X86
+static block_masks classify_sse2(char const *p) {
+    block_masks res{0, 0, 0, 0};
+    for (size_t i = 0; i < BLOCK; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        __m128i alpha = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                                   _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1))),
+                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                     _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('\t' - 1)),
+                                                   _mm_cmplt_epi8(x, _mm_set1_epi8('\r' + 1))));
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('+')),
+                                               _mm_cmpeq_epi8(x, _mm_set1_epi8('-'))),
+                                  _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('*')),
+                                               _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('(')),
+                                                            _mm_cmpeq_epi8(x, _mm_set1_epi8(')')))));
+        auto d = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(digit)));
+        auto a = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(alpha)));
+        auto o = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(op)));
+        auto s = static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(space)));
+        res.digit |= d << i;
+        res.alpha |= a << i;
+        res.op |= o << i;
+        res.invalid |= (~(d | a | o | s) & 0xFFFFu) << i;
     }
-    check();
-    res.emplace_back(END, "");
     return res;
 }
 
+__attribute__((target("avx2")))
+static block_masks classify_avx2(char const *p) {
+    block_masks res{0, 0, 0, 0};
+    for (size_t i = 0; i < BLOCK; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x));
+        __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        __m256i alpha = _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower)),
+                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                        _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('\t' - 1)),
+                                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), x)));
+        __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('+')),
+                                                     _mm256_cmpeq_epi8(x, _mm256_set1_epi8('-'))),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')),
+                                                     _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('(')),
+                                                                     _mm256_cmpeq_epi8(x, _mm256_set1_epi8(')')))));
+        auto d = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(digit)));
+        auto a = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(alpha)));
+        auto o = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(op)));
+        auto s = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(space)));
+        res.digit |= d << i;
+        res.alpha |= a << i;
+        res.op |= o << i;
+        res.invalid |= (~(d | a | o | s) & 0xFFFFFFFFu) << i;
+    }
+    return res;
+}
+#endif
+
+// Word runs (digits, letters, '_') are split into tokens between events: a run starts
+// a NUMBER or an IDENTIFIER by its first byte, and a letter right after a digit starts
+// an IDENTIFIER if the run is a NUMBER so far.
+static void lex_blocks(token_buffer &res, classify_fn classify) {
+    std::string_view src = res.source();
+    size_t run_start = 0;
+    token_type run_type = END;
+    uint64_t word_carry = 0;
+    uint64_t digit_carry = 0;
+    auto emit = [&](size_t base, block_masks m) {
+        if (m.invalid) {
+            throw lexer_exception(src, res.locate(base + __builtin_ctzll(m.invalid), 1));
+        }
+        uint64_t word = m.digit | m.alpha;
+        uint64_t prev = (word << 1) | word_carry;
+        uint64_t starts = word & ~prev;
+        uint64_t ends = ~word & prev;
+        uint64_t splits = m.alpha & ((m.digit << 1) | digit_carry) & prev;
+        uint64_t events = starts | ends | splits | m.op;
+        while (events) {
+            auto p = static_cast<size_t>(__builtin_ctzll(events));
+            uint64_t bit = events & (~events + 1);
+            if (ends & bit) {
+                res.push_back(run_type, run_start, base + p - run_start);
+            }
+            if (starts & bit) {
+                run_start = base + p;
+                run_type = (m.alpha & bit) ? IDENTIFIER : NUMBER;
+            }
+            if ((splits & bit) && run_type == NUMBER) {
+                res.push_back(NUMBER, run_start, base + p - run_start);
+                run_start = base + p;
+                run_type = IDENTIFIER;
+            }
+            if (m.op & bit) {
+                res.push_back(static_cast<token_type>(ops.type[static_cast<uint8_t>(src[base + p])]), base + p, 1);
+            }
+            events ^= bit;
+        }
+        word_carry = word >> 63;
+        digit_carry = m.digit >> 63;
+    };
+    size_t base = 0;
+    for (; base + BLOCK <= src.size(); base += BLOCK) {
+        emit(base, classify(src.data() + base));
+    }
+    if (base < src.size()) {
+        char tail[BLOCK];
+        std::memset(tail, ' ', BLOCK);
+        std::memcpy(tail, src.data() + base, src.size() - base);
+        emit(base, classify(tail));
+    } else if (word_carry) {
+        res.push_back(run_type, run_start, src.size() - run_start);
+    }
+    res.push_back(END, src.size(), 0);
+}
+
+token_stream::token_stream(std::istream &in, size_t buffer_size) : in(in), buff(buffer_size), cur(END) {
+    advance();
+    ind = 0;
+}
 
+bool token_stream::refill() {
+    if (len >= DIAGNOSTIC_WINDOW) {
+        history.assign(buff.data() + len - DIAGNOSTIC_WINDOW, DIAGNOSTIC_WINDOW);
+    } else {
+        history.append(buff.data(), len);
+        if (history.size() > DIAGNOSTIC_WINDOW) {
+            history.erase(0, history.size() - DIAGNOSTIC_WINDOW);
+        }
+    }
+    consumed += len;
+    pos = 0;
+    len = in ? static_cast<size_t>(in.read(buff.data(), buff.size()).gcount()) : 0;
+    PARSER_STATS_ADD(bytes_read, len);
+    return len != 0;
+}
+
+void token_stream::advance() {
+    ++ind;
+    cur.data.clear();
+    cur.value = 0;
+    cur.limbs.clear();
+    while (pos < len || refill()) {
+        char c = buff[pos];
+        if (my_isspace(c)) {
+            ++pos;
+            if (c == '\n') {
+                ++line;
+                line_start = consumed + pos;
+            }
+            continue;
+        }
+        cur.span.offset = consumed + pos;
+        cur.span.line = line;
+        cur.span.column = static_cast<uint32_t>(cur.span.offset - line_start + 1);
+        if (is_digit(c) || is_ident_start(c)) {
+            cur.type = is_digit(c) ? NUMBER : IDENTIFIER;
+            auto inside = cur.type == NUMBER ? is_digit : is_ident_char;
+            lead_offset = SIZE_MAX;
+            do {
+                size_t start = pos;
+                while (pos < len && inside(buff[pos])) {
+                    ++pos;
+                }
+                cur.data.append(buff.data() + start, pos - start);
+                if (pos == len && lead_offset == SIZE_MAX) {
+                    // The number outlives the buffer; keep what preceded it.
+                    lead = context(cur.span);
+                    lead_offset = cur.span.offset;
+                }
+            } while (pos == len && refill());
+            cur.span.length = cur.data.size();
+            cur.decode();
+            PARSER_STATS_ADD(tokens[cur.type], 1);
+            return;
+        }
+        auto type = static_cast<token_type>(ops.type[static_cast<uint8_t>(c)]);
+        if (type == END) {
+            cur.span.length = 1;
+            throw lexer_exception(context(cur.span), c, cur.span);
+        }
+        ++pos;
+        cur.type = type;
+        cur.data.push_back(c);
+        cur.span.length = 1;
+        PARSER_STATS_ADD(tokens[type], 1);
+        return;
+    }
+    cur.type = END;
+    cur.span.offset = consumed + pos;
+    cur.span.length = 0;
+    cur.span.line = line;
+    cur.span.column = static_cast<uint32_t>(cur.span.offset - line_start + 1);
+    PARSER_STATS_ADD(tokens[END], 1);
+}
+
+std::string token_stream::context(source_span const &at) const {
+    if (at.offset == lead_offset) {
+        return lead;
+    }
+    // The buffered text is the history tail followed by buff[0, len).
+    size_t available = consumed - history.size();
+    size_t from = at.offset - std::min<size_t>(at.column - 1, DIAGNOSTIC_WINDOW);
+    from = std::max(from, available);
+    std::string res;
+    for (size_t i = from; i < at.offset; ++i) {
+        res.push_back(i < consumed ? history[i - available] : buff[i - consumed]);
+    }
+    return res;
+}
+
+bool kernel_supported(lexer_kernel kernel) {
+    switch (kernel) {
+        case KERNEL_AUTO:
+        case KERNEL_SCALAR: {
+            return true;
+        }
+#ifdef LEXER_X86
+        case KERNEL_SSE2: {
+            return __builtin_cpu_supports("sse2");
+        }
+        case KERNEL_AVX2: {
+            return __builtin_cpu_supports("avx2");
+        }
+#endif
+        default: {
+            return false;
+        }
+    }
+}
+
+void tokenize_into(token_buffer &res, lexer_kernel kernel) {
+    if (kernel == KERNEL_AUTO) {
+        kernel = kernel_supported(KERNEL_AVX2) ? KERNEL_AVX2
+                : kernel_supported(KERNEL_SSE2) ? KERNEL_SSE2 : KERNEL_SCALAR;
+    }
+    if (!kernel_supported(kernel)) {
+        kernel = KERNEL_SCALAR;
+    }
+    PARSER_STATS_PHASE(PHASE_TOKENIZE);
+    PARSER_STATS_ADD(bytes_read, res.source().size());
+    res.index_lines();
+    switch (kernel) {
+#ifdef LEXER_X86
+        case KERNEL_SSE2: {
+            lex_blocks(res, classify_sse2);
+            break;
+        }
+        case KERNEL_AVX2: {
+            lex_blocks(res, classify_avx2);
+            break;
+        }
+#endif
+        default: {
+            lex(res);
+            break;
+        }
+    }
+    PARSER_STATS_ONLY(count_tokens(res);)
+}
+
+token_buffer tokenize_buffer(string s, lexer_kernel kernel) {
+    token_buffer res(std::move(s));
+    tokenize_into(res, kernel);
+    return res;
+}
+
+token_buffer tokenize_buffer(std::string_view source, std::shared_ptr<void const> storage, lexer_kernel kernel) {
+    token_buffer res(source, std::move(storage));
+    tokenize_into(res, kernel);
+    return res;
+}
+
+token_buffer tokenize_buffer(istream &in, lexer_kernel kernel) {
+    string source;
+    {
+        PARSER_STATS_PHASE(PHASE_READ);
+        source.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    return tokenize_buffer(std::move(source), kernel);
+}
+
+vector<token> tokenize(istream &in) {
+    return tokenize_buffer(in).to_vector();
+}
+
+vector<token> token_buffer::to_vector() const {
+    vector<token> res;
+    res.reserve(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        res.push_back(at(i));
+    }
+    return res;
+}
+
+std::pmr::vector<token> token_buffer::to_vector(std::pmr::memory_resource *resource) const {
+    std::pmr::vector<token> res(resource);
+    res.reserve(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        res.emplace_back(type(i), text(i), span(i), value(i), is_long(i) ? limbs(i) : nullptr);
+    }
+    return res;
+}
 
 std::ostream &operator<<(std::ostream &os, token_type type) {
     switch (type) {
@@ -88,6 +439,9 @@ std::ostream &operator<<(std::ostream &os, token_type type) {
         case NUMBER: {
             return os << "NUMBER";
         }
+        case IDENTIFIER: {
+            return os << "IDENTIFIER";
+        }
         case END: {
             return os << "END";
         }
@@ -95,8 +449,38 @@ std::ostream &operator<<(std::ostream &os, token_type type) {
 }
 
 std::vector<token> tokenize(std::string const &s) {
-    std::istringstream in(s);
-    return tokenize(in);
+    return tokenize_buffer(s).to_vector();
+}
+
+std::pmr::vector<token> tokenize(istream &in, std::pmr::memory_resource *resource) {
+    return tokenize_buffer(in).to_vector(resource);
+}
+
+std::pmr::vector<token> tokenize(std::string const &s, std::pmr::memory_resource *resource) {
+    return tokenize_buffer(s).to_vector(resource);
+}
+
+token::token(token_type _type, std::string_view _data, source_span _span, uint64_t _value,
+             uint32_t const *_limbs, allocator_type alloc)
+        : type(_type), data(_data, alloc), span(_span), value(_value), limbs(alloc) {
+    if (_type == NUMBER && is_long()) {
+        limbs.assign(_limbs, _limbs + limb_count(_data.size()));
+        value = 0;
+    }
+}
+
+void token::decode() {
+    value = 0;
+    limbs.clear();
+    if (type != NUMBER) {
+        return;
+    }
+    if (!is_long()) {
+        value = decode_digits(data.data(), data.size());
+    } else {
+        limbs.resize(limb_count(data.size()));
+        decode_limbs(data.data(), data.size(), limbs.data());
+    }
 }
 
 bool operator==(token const &a, token const &b) {
@@ -108,19 +492,60 @@ bool operator!=(token const &a, token const &b) {
 }
 
 
-lexer_exception::lexer_exception(std::istream &in) : reason("Unexpected symbol at position ") {
-    auto pos = in.tellg();
-    reason.append(std::to_string(pos));
-    reason.append(":\n");
-    auto sz = reason.size();
-    reason.resize(sz + pos);
-    in.seekg(0);
-    in.read(reason.data() + sz, pos);
-    reason.push_back('\n');
-    pos -= 1;
-    while (pos > 0) {
-        reason.push_back(' ');
-        pos -= 1;
+void append_excerpt(std::string &out, std::string_view before, std::string_view at, uint32_t column) {
+    if (before.size() > DIAGNOSTIC_WINDOW) {
+        before.remove_prefix(before.size() - DIAGNOSTIC_WINDOW);
+    }
+    bool long_token = at.size() > DIAGNOSTIC_WINDOW;
+    if (long_token) {
+        at = at.substr(0, DIAGNOSTIC_WINDOW);
+    }
+    size_t indent = before.size();
+    if (before.size() + 1 < column) {
+        out.append("...");
+        indent += 3;
+    }
+    out.append(before);
+    out.append(at);
+    if (long_token) {
+        out.append("...");
+    }
+    out.push_back('\n');
+    out.append(indent, ' ');
+    out.push_back('^');
+    if (at.size() > 1) {
+        out.append(at.size() - 1, '~');
+    }
+}
+
+static std::string lexer_reason(source_span const &where) {
+    return "Unexpected symbol at position " + std::to_string(where.offset + 1) + " (line "
+           + std::to_string(where.line) + ", column " + std::to_string(where.column) + "):\n";
+}
+
+lexer_exception::lexer_exception(std::string_view before, char found, source_span where)
+        : reason(lexer_reason(where)) {
+    append_excerpt(reason, before, std::string_view(&found, 1), where.column);
+}
+
+lexer_exception::lexer_exception(std::string_view source, source_span where) : reason(lexer_reason(where)) {
+    auto from = where.offset - std::min<size_t>(where.column - 1, DIAGNOSTIC_WINDOW);
+    append_excerpt(reason, source.substr(from, where.offset - from), source.substr(where.offset, 1), where.column);
+}
+
+void token_buffer::index_lines() {
+    line_starts.assign(1, 0);
+    auto const *begin = source().data();
+    auto const *end = begin + source().size();
+    for (auto const *p = begin; (p = static_cast<char const *>(std::memchr(p, '\n', end - p))); ++p) {
+        line_starts.push_back(p - begin + 1);
+    }
+}
+
+source_span token_buffer::locate(size_t offset, size_t length) const {
+    if (line_starts.empty()) {
+        return {offset, length, 1, static_cast<uint32_t>(offset + 1)};
     }
-    reason.append("^");
+    auto it = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - 1;
+    return {offset, length, static_cast<uint32_t>(it - line_starts.begin() + 1), static_cast<uint32_t>(offset - *it + 1)};
 }
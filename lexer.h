@@ -2,10 +2,30 @@
 
 #pragma once
 
+#include <cstdint>
 #include <exception>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include "digits.h"
+
+// Location of a piece of source text. Line and column are 1-based, columns count bytes.
+struct source_span {
+    size_t offset = 0;
+    size_t length = 0;
+    uint32_t line = 1;
+    uint32_t column = 1;
+};
+
+// Diagnostics quote at most this many bytes of the line before the error.
+constexpr size_t DIAGNOSTIC_WINDOW = 64;
+
+// Appends the quoted text and a caret line under `at`. `before` is the text of the
+// line preceding `at`; if it starts later than `column` implies, it is marked as cut.
+void append_excerpt(std::string &out, std::string_view before, std::string_view at, uint32_t column);
 
 class lexer_exception : public std::exception {
     std::string reason;
@@ -14,25 +34,228 @@ public:
         return reason.c_str();
     }
 
-    explicit lexer_exception(std::istream &in);
+    lexer_exception(std::string_view before, char found, source_span where);
+    lexer_exception(std::string_view source, source_span where);
 };
 
 enum token_type {
-    LEFT_PARENTHESIS, RIGHT_PARENTHESIS, PLUS, MINUS, NUMBER, MUL, END
+    LEFT_PARENTHESIS, RIGHT_PARENTHESIS, PLUS, MINUS, NUMBER, MUL, IDENTIFIER, END
 };
 
 std::ostream& operator<<(std::ostream &os, token_type type);
 
+// The literal is allocated from the token's memory resource, the default one unless given.
+// A NUMBER token also carries the decoded literal: in value if it has at most
+// SHORT_DIGITS digits, otherwise in base 10^9 limbs, least significant first.
 struct token {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
     token_type type;
-    std::string data;
+    std::pmr::string data;
+    source_span span;
+    uint64_t value = 0;
+    std::pmr::vector<uint32_t> limbs;
+
+    explicit token(token_type _type, std::string_view _data = "", source_span _span = {},
+                   allocator_type alloc = {})
+            : type(_type), data(_data, alloc), span(_span), limbs(alloc) {
+        decode();
+    }
+
+    // Takes an already decoded value; limbs points to limb_count(_data.size()) limbs
+    // for a long literal.
+    token(token_type _type, std::string_view _data, source_span _span, uint64_t _value,
+          uint32_t const* _limbs, allocator_type alloc = {});
+
+    token(token const&) = default;
+    token(token&&) = default;
+    token& operator=(token const&) = default;
+    token& operator=(token&&) = default;
 
-    explicit token(token_type _type, std::string _data = "")
-            : type(_type), data(std::move(_data)) {}
+    token(token const& other, allocator_type alloc)
+            : type(other.type), data(other.data, alloc), span(other.span), value(other.value),
+              limbs(other.limbs, alloc) {}
+    token(token&& other, allocator_type alloc)
+            : type(other.type), data(std::move(other.data), alloc), span(other.span), value(other.value),
+              limbs(std::move(other.limbs), alloc) {}
+
+    // Fills value or limbs from data if this is a NUMBER.
+    void decode();
+
+    bool is_long() const {
+        return data.size() > SHORT_DIGITS;
+    }
+
+    allocator_type get_allocator() const {
+        return data.get_allocator();
+    }
 };
 
 bool operator==(token const& a, token const& b);
 bool operator!=(token const& a, token const& b);
 
+// Token literal stored as a span of the source it was lexed from. For a NUMBER, value
+// is the decoded literal, or the position of its limbs in token_buffer if it is long.
+struct packed_token {
+    size_t offset;
+    uint64_t value;
+    uint32_t length;
+    uint8_t type;
+};
+
+// The source is either owned, or external memory such as a file mapping that storage
+// keeps alive; an external source is lexed in place, without a copy.
+class token_buffer {
+    std::string src;
+    std::string_view external;
+    std::shared_ptr<void const> storage;
+    std::vector<packed_token> tokens;
+    std::vector<size_t> line_starts;
+    std::vector<uint32_t> limb_store;
+public:
+    token_buffer() = default;
+    explicit token_buffer(std::string source) : src(std::move(source)) {}
+    token_buffer(std::string_view source, std::shared_ptr<void const> _storage)
+            : external(source), storage(std::move(_storage)) {}
+
+    // Replaces the source and drops the tokens, keeping the allocated capacity.
+    void reset(std::string source) {
+        src = std::move(source);
+        storage.reset();
+        tokens.clear();
+        line_starts.clear();
+        limb_store.clear();
+    }
+
+    void assign(std::string_view source) {
+        src.assign(source);
+        storage.reset();
+        tokens.clear();
+        line_starts.clear();
+        limb_store.clear();
+    }
+
+    // Records where every line of the source starts; tokenize_into() does this first.
+    void index_lines();
+    source_span locate(size_t offset, size_t length) const;
+
+    source_span span(size_t i) const {
+        return locate(tokens[i].offset, tokens[i].length);
+    }
+
+    // Decodes NUMBER literals as they are pushed, while their digits are still in cache.
+    void push_back(token_type type, size_t offset, size_t length) {
+        uint64_t value = 0;
+        if (type == NUMBER) {
+            if (length <= SHORT_DIGITS) {
+                value = decode_digits(source().data() + offset, length);
+            } else {
+                value = limb_store.size();
+                limb_store.resize(value + limb_count(length));
+                decode_limbs(source().data() + offset, length, limb_store.data() + value);
+            }
+        }
+        tokens.push_back({offset, value, static_cast<uint32_t>(length), static_cast<uint8_t>(type)});
+    }
+
+    size_t size() const {
+        return tokens.size();
+    }
+
+    token_type type(size_t i) const {
+        return static_cast<token_type>(tokens[i].type);
+    }
+
+    std::string_view text(size_t i) const {
+        return source().substr(tokens[i].offset, tokens[i].length);
+    }
+
+    size_t offset(size_t i) const {
+        return tokens[i].offset;
+    }
+
+    bool is_long(size_t i) const {
+        return tokens[i].length > SHORT_DIGITS;
+    }
+
+    // Decoded value of a NUMBER token that is not long.
+    uint64_t value(size_t i) const {
+        return tokens[i].value;
+    }
+
+    // The limb_count() limbs of a long NUMBER token.
+    uint32_t const* limbs(size_t i) const {
+        return limb_store.data() + tokens[i].value;
+    }
+
+    std::string_view source() const {
+        return storage ? external : std::string_view(src);
+    }
+
+    token at(size_t i, token::allocator_type alloc = {}) const {
+        return token(type(i), text(i), span(i), value(i), is_long(i) ? limbs(i) : nullptr, alloc);
+    }
+
+    std::vector<token> to_vector() const;
+    std::pmr::vector<token> to_vector(std::pmr::memory_resource *resource) const;
+};
+
+// Pull-based lexer over a stream with a fixed-size refill buffer and one token of lookahead.
+class token_stream {
+    std::istream &in;
+    std::vector<char> buff;
+    size_t pos = 0;
+    size_t len = 0;
+    size_t consumed = 0;
+    size_t ind = 0;
+    uint32_t line = 1;
+    size_t line_start = 0;
+    std::string history;
+    std::string lead;
+    size_t lead_offset = SIZE_MAX;
+    token cur;
+
+    bool refill();
+public:
+    explicit token_stream(std::istream &in, size_t buffer_size = 1 << 16);
+
+    token_type type() const {
+        return cur.type;
+    }
+
+    token const& current() const {
+        return cur;
+    }
+
+    size_t index() const {
+        return ind;
+    }
+
+    token take() {
+        return std::move(cur);
+    }
+
+    void advance();
+
+    // Up to DIAGNOSTIC_WINDOW bytes of the line before `at`, if they are still buffered.
+    std::string context(source_span const &at) const;
+};
+
+enum lexer_kernel {
+    KERNEL_AUTO, KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2
+};
+
+bool kernel_supported(lexer_kernel kernel);
+
 std::vector<token> tokenize(std::istream &in);
-std::vector<token> tokenize(std::string const& s);
\ No newline at end of file
+std::vector<token> tokenize(std::string const& s);
+// The vector and the token literals are allocated from resource.
+std::pmr::vector<token> tokenize(std::istream &in, std::pmr::memory_resource *resource);
+std::pmr::vector<token> tokenize(std::string const& s, std::pmr::memory_resource *resource);
+
+void tokenize_into(token_buffer &res, lexer_kernel kernel = KERNEL_AUTO);
+token_buffer tokenize_buffer(std::istream &in, lexer_kernel kernel = KERNEL_AUTO);
+token_buffer tokenize_buffer(std::string s, lexer_kernel kernel = KERNEL_AUTO);
+// Lexes source in place; storage owns the memory it points to.
+token_buffer tokenize_buffer(std::string_view source, std::shared_ptr<void const> storage,
+                             lexer_kernel kernel = KERNEL_AUTO);
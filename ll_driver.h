@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include "grammar_tables.h"
+
+// The table-driven LL(1) loop over the tables generated from grammar.ll, shared by
+// parse_symbol() and the constexpr static_tree. It pops symbols off stack until it is
+// empty, matching terminals against data and expanding nonterminals by the predict
+// table, and reports every node to out: open(type, size) before a nonterminal's
+// children and close() after them, term(data, ind) and eps() for the leaves.
+//
+// data supplies type(ind) and next(ind); fail(ind, top) is called with the symbol that
+// doesn't match the token at ind and must not return. stack needs empty(), back(),
+// pop_back() and push_back(); its size bounds the nesting depth, not the native stack.
+template <class Source, class Stack, class Builder, class Fail>
+constexpr void ll_parse(Source const &data, size_t &ind, Stack &stack, Builder &out, Fail const &fail) {
+    using namespace grammar;
+    while (!stack.empty()) {
+        auto top = stack.back();
+        stack.pop_back();
+        switch (top.kind) {
+            case CLOSE: {
+                out.close();
+                break;
+            }
+            case EPSILON: {
+                out.eps();
+                break;
+            }
+            case TERMINAL: {
+                if (data.type(ind) != top.value) {
+                    fail(ind, top);
+                    __builtin_unreachable();
+                }
+                out.term(data, ind);
+                data.next(ind);
+                break;
+            }
+            case NONTERMINAL: {
+                auto type = static_cast<node_type>(top.value);
+                auto rule = predict[type][data.type(ind)];
+                if (rule < 0) {
+                    fail(ind, top);
+                    __builtin_unreachable();
+                }
+                auto const &cur = productions[rule];
+                out.open(type, cur.size);
+                stack.push_back({CLOSE, 0});
+                for (size_t i = cur.size; i-- > 0;) {
+                    stack.push_back(cur.rhs[i]);
+                }
+                break;
+            }
+        }
+    }
+}
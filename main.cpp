@@ -2,8 +2,20 @@
 #include <sstream>
 #include <fstream>
 #include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <csignal>
+#include <pthread.h>
 #include "lexer.h"
 #include "parser.h"
+#include "ast.h"
+#include "batch.h"
+#include "binary_tree.h"
+#include "mapped_file.h"
+#include "stats.h"
+#include "server.h"
+#include "render.h"
 
 using std::string;
 using std::istringstream;
@@ -14,32 +26,136 @@ using std::endl;
 
 void print_usage() {
     cerr << "Invalid options. Usage:\n";
-    cerr << "-s <string_to_parse>\n";
-    cerr << "-f <file_to_parse>\n";
+    cerr << "[--ast] -s <string_to_parse>\n";
+    cerr << "[--ast] -f <file_to_parse|->\n";
+    cerr << "--binary <output_file> (-s|-f) <input>\n";
+    cerr << "--render <verbatim|normalized|canonical> (-s|-f) <input>: print the expression back as text\n";
+    cerr << "--stats[=json] (-s|-f) <input>: also print parse statistics to stderr\n";
+    cerr << "[--ast] [--threads N] [--unordered] --batch <file_with_one_expression_per_line|->\n";
+    cerr << "[--ast] [--threads N] [--length-prefixed] --serve <unix_socket_path|:port>\n";
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        print_usage();
-        return 0;
+    bool as_ast = false;
+    batch_options batch;
+    server_options serve;
+    char const *mode = nullptr;
+    char const *arg = nullptr;
+    char const *binary_out = nullptr;
+    int render_as = -1;
+    char const *stats_format = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--ast")) {
+            as_ast = true;
+        } else if (!std::strcmp(argv[i], "--unordered")) {
+            batch.ordered = false;
+        } else if (!std::strcmp(argv[i], "--length-prefixed")) {
+            serve.frames = FRAMING_LENGTH;
+        } else if (!std::strcmp(argv[i], "--stats") || !std::strcmp(argv[i], "--stats=json")) {
+            stats_format = argv[i];
+        } else if (!std::strcmp(argv[i], "--binary") && i + 1 < argc) {
+            binary_out = argv[++i];
+        } else if (!std::strcmp(argv[i], "--render") && i + 1 < argc) {
+            ++i;
+            if (!std::strcmp(argv[i], "verbatim")) {
+                render_as = RENDER_VERBATIM;
+            } else if (!std::strcmp(argv[i], "normalized")) {
+                render_as = RENDER_NORMALIZED;
+            } else if (!std::strcmp(argv[i], "canonical")) {
+                render_as = RENDER_CANONICAL;
+            } else {
+                print_usage();
+                return 0;
+            }
+        } else if (!std::strcmp(argv[i], "--threads") && i + 1 < argc) {
+            batch.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if ((!std::strcmp(argv[i], "-s") || !std::strcmp(argv[i], "-f") || !std::strcmp(argv[i], "--batch")
+                    || !std::strcmp(argv[i], "--serve"))
+                   && !mode && i + 1 < argc) {
+            mode = argv[i];
+            arg = argv[++i];
+        } else {
+            print_usage();
+            return 0;
+        }
     }
-    if ((std::strcmp(argv[1], "-s") != 0) && (std::strcmp(argv[1], "-f") != 0)) {
+    bool streaming = mode && (!std::strcmp(mode, "--batch") || !std::strcmp(mode, "--serve"));
+    bool rendering = render_as >= 0;
+    if (!mode || batch.threads == 0 || ((binary_out || rendering) && (as_ast || streaming))
+        || (binary_out && rendering) || (stats_format && streaming)) {
         print_usage();
         return 0;
     }
+    parse_stats stats;
     try {
-        if (!std::strcmp(argv[1], "-s")) {
-            cout << parse(argv[2]).to_json();
+        if (!std::strcmp(mode, "--serve")) {
+            serve.threads = batch.threads;
+            serve.ast = as_ast;
+            // SIGINT and SIGTERM stop the server, which answers what it has read and
+            // removes its socket; the workers inherit the blocked mask.
+            sigset_t signals;
+            sigemptyset(&signals);
+            sigaddset(&signals, SIGINT);
+            sigaddset(&signals, SIGTERM);
+            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+            parse_server server(arg, serve);
+            if (server.port()) {
+                cerr << "Listening on port " << server.port() << endl;
+            }
+            std::thread([&server, signals] {
+                int signal;
+                sigwait(&signals, &signal);
+                server.stop();
+            }).detach();
+            server.run();
+            return 0;
+        }
+        if (!std::strcmp(mode, "--batch")) {
+            batch.ast = as_ast;
+            if (!std::strcmp(arg, "-")) {
+                run_batch(std::cin, cout, batch);
+            } else {
+                ifstream in(arg);
+                if (!in.is_open()) {
+                    cerr << "Can't open file: " << arg << endl;
+                    return 0;
+                }
+                run_batch(in, cout, batch);
+            }
+            return 0;
+        }
+        stats_scope scope(stats);
+        token_buffer tokens;
+        if (!std::strcmp(mode, "-s")) {
+            tokens = tokenize_buffer(arg);
         } else {
-            ifstream in(argv[2]);
-            if (!in.is_open()) {
-                cerr << "Can't open file: " << argv[2] << endl;
+            auto input = std::make_shared<input_buffer>(arg);
+            tokens = tokenize_buffer(input->view(), input);
+        }
+        if (binary_out) {
+            std::ofstream out(binary_out, std::ios::binary);
+            if (!out.is_open()) {
+                cerr << "Can't open file: " << binary_out << endl;
                 return 0;
             }
-            cout << parse(tokenize(in)).to_json();
+            write_binary(parse(tokens), out);
+        } else if (rendering) {
+            render(parse(tokens), cout, static_cast<render_mode>(render_as));
+            cout << '\n';
+        } else if (as_ast) {
+            cout << parse_ast(std::move(tokens)).to_json(2);
+        } else {
+            parse(tokens).to_json(cout);
         }
     } catch (std::exception const& e) {
         cerr << e.what();
     }
+    if (stats_format && !parse_stats::enabled) {
+        cerr << "Statistics are disabled in this build (PARSER_STATS is off)\n";
+    } else if (stats_format && !std::strcmp(stats_format, "--stats=json")) {
+        cerr << stats.to_json() << '\n';
+    } else if (stats_format) {
+        stats.print(cerr);
+    }
     return 0;
-}
\ No newline at end of file
+}
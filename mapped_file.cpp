@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+#include "stats.h"
+
+mapped_file::mapped_file(std::string const &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Can't open file: " + path);
+    }
+    try {
+        *this = mapped_file(fd, path);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+mapped_file::mapped_file(int fd, std::string const &name) {
+    struct stat info{};
+    if (::fstat(fd, &info) < 0) {
+        int err = errno;
+        throw std::system_error(err, std::generic_category(), "Can't stat file: " + name);
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length) {
+        ptr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            int err = errno;
+            ptr = nullptr;
+            length = 0;
+            throw std::system_error(err, std::generic_category(), "Can't map file: " + name);
+        }
+    }
+}
+
+mapped_file::mapped_file(mapped_file &&other) noexcept
+        : ptr(std::exchange(other.ptr, nullptr)), length(std::exchange(other.length, 0)) {}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) noexcept {
+    if (this != &other) {
+        if (ptr) {
+            ::munmap(ptr, length);
+        }
+        ptr = std::exchange(other.ptr, nullptr);
+        length = std::exchange(other.length, 0);
+    }
+    return *this;
+}
+
+mapped_file::~mapped_file() {
+    if (ptr) {
+        ::munmap(ptr, length);
+    }
+}
+
+void mapped_file::advise(int advice) const {
+    if (ptr) {
+        ::madvise(ptr, length, advice);
+    }
+}
+
+input_buffer::input_buffer(std::string const &path) {
+    if (path == "-") {
+        *this = input_buffer(STDIN_FILENO, "standard input");
+        return;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Can't open file: " + path);
+    }
+    try {
+        *this = input_buffer(fd, path);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+}
+
+input_buffer::input_buffer(int fd, std::string const &name) {
+    struct stat info{};
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        try {
+            map = mapped_file(fd, name);
+            map.advise(MADV_SEQUENTIAL);
+            map.advise(MADV_WILLNEED);
+            is_mapped = true;
+            return;
+        } catch (std::system_error const &) {
+            // Some file systems can't be mapped; read them like a pipe.
+        }
+    }
+    read_all(fd, name);
+}
+
+void input_buffer::read_all(int fd, std::string const &name) {
+    PARSER_STATS_PHASE(PHASE_READ);
+    constexpr size_t CHUNK = 1 << 16;
+    size_t used = 0;
+    while (true) {
+        if (owned.size() - used < CHUNK) {
+            owned.resize(std::max(2 * owned.size(), used + CHUNK));
+        }
+        auto got = ::read(fd, &owned[used], owned.size() - used);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            int err = errno;
+            throw std::system_error(err, std::generic_category(), "Can't read " + name);
+        }
+        if (got == 0) {
+            break;
+        }
+        used += static_cast<size_t>(got);
+    }
+    owned.resize(used);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file. Empty files map to a null pointer.
+class mapped_file {
+    void *ptr = nullptr;
+    size_t length = 0;
+
+public:
+    mapped_file() = default;
+    explicit mapped_file(std::string const &path);
+    // Maps the file behind an open descriptor, which stays open; name is for messages.
+    mapped_file(int fd, std::string const &name);
+    mapped_file(mapped_file &&other) noexcept;
+    mapped_file &operator=(mapped_file &&other) noexcept;
+    mapped_file(mapped_file const &) = delete;
+    mapped_file &operator=(mapped_file const &) = delete;
+    ~mapped_file();
+
+    char const *data() const {
+        return static_cast<char const *>(ptr);
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    // Passes an madvise() hint for the whole mapping; failures are ignored.
+    void advise(int advice) const;
+};
+
+// Whole contents of an input as one contiguous buffer. Regular files are mapped and
+// advised for sequential reading; pipes, terminals and files that can't be mapped are
+// read with read() into an owned buffer.
+class input_buffer {
+    mapped_file map;
+    std::string owned;
+    bool is_mapped = false;
+
+    void read_all(int fd, std::string const &name);
+public:
+    // "-" is the standard input.
+    explicit input_buffer(std::string const &path);
+    input_buffer(int fd, std::string const &name);
+
+    std::string_view view() const {
+        return is_mapped ? std::string_view(map.data(), map.size()) : std::string_view(owned);
+    }
+
+    bool mapped() const {
+        return is_mapped;
+    }
+};
@@ -1,152 +1,823 @@
+#include <algorithm>
+#include <stdexcept>
 #include <type_traits>
 #include "parser.h"
+#include "ast.h"
+#include "dag.h"
+#include "grammar_tables.h"
+#include "json_writer.h"
+#include "ll_driver.h"
+#include "render.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+
+namespace {
+    template <class Vector>
+    struct vector_source {
+        Vector const &data;
+
+        size_t size() const {
+            return data.size();
+        }
+
+        token_type type(size_t i) const {
+            return data[i].type;
+        }
+
+        token const &get(size_t i, token::allocator_type = {}) const {
+            return data[i];
+        }
+
+        void next(size_t &i) const {
+            ++i;
+        }
+
+        [[noreturn]] void fail(size_t i, std::vector<token_type> const &expected) const {
+            throw parser_exception(data, i, expected);
+        }
+    };
+
+    struct buffer_source {
+        token_buffer const &data;
+
+        size_t size() const {
+            return data.size();
+        }
+
+        token_type type(size_t i) const {
+            return data.type(i);
+        }
+
+        token get(size_t i, token::allocator_type alloc = {}) const {
+            return data.at(i, alloc);
+        }
+
+        std::string_view text(size_t i) const {
+            return data.text(i);
+        }
+
+        void next(size_t &i) const {
+            ++i;
+        }
+
+        [[noreturn]] void fail(size_t i, std::vector<token_type> const &expected) const {
+            throw parser_exception(data, i, expected);
+        }
+    };
+
+    struct stream_source {
+        token_stream &data;
+
+        token_type type(size_t) const {
+            return data.type();
+        }
+
+        token get(size_t, token::allocator_type = {}) const {
+            return data.take();
+        }
 
+        void next(size_t &i) const {
+            data.advance();
+            ++i;
+        }
 
-static bool in_list(token_type x, std::initializer_list<token_type> list) {
-    for (auto item : list) {
-        if (x == item) {
-            return true;
+        [[noreturn]] void fail(size_t i, std::vector<token_type> const &expected) const {
+            throw parser_exception(data.current(), data.context(data.current().span), i, expected);
         }
+    };
+}
+
+static source_span end_of(source_span const &span) {
+    return {span.offset + span.length, 0, span.line, static_cast<uint32_t>(span.column + span.length)};
+}
+
+// Sets the span of a nonterminal from its already spanned children.
+static void cover_children(node &cur, source_span const &empty_at) {
+    node const *first = nullptr;
+    node const *last = nullptr;
+    for (auto &&item : cur.children) {
+        if (item.span.length) {
+            first = first ? first : &item;
+            last = &item;
+        }
+    }
+    if (!first) {
+        cur.span = empty_at;
+        return;
     }
-    return false;
+    cur.span = first->span;
+    cur.span.length = last->span.offset + last->span.length - first->span.offset;
 }
 
+namespace {
+    struct node_builder {
+        std::optional<node> root;
+        std::vector<node *> stack;
+        source_span last_end;
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource();
+
+        void open(node_type type, size_t children) {
+            node *cur;
+            if (stack.empty()) {
+                cur = &root.emplace(type, resource);
+            } else {
+                cur = &stack.back()->children.emplace_back(type);
+            }
+            cur->children.reserve(children);
+            stack.push_back(cur);
+        }
 
-static node parse_E(const std::vector<token> &data, size_t &ind);
+        template <class Source>
+        void term(Source const &data, size_t ind) {
+            last_end = end_of(stack.back()->children.emplace_back(TERM, data.get(ind, resource)).span);
+        }
 
-static node parse_X(const std::vector<token> &data, size_t &ind);
+        void eps() {
+            stack.back()->children.emplace_back(EPS).span = last_end;
+        }
 
-static node parse_T(const std::vector<token> &data, size_t &ind);
+        void close() {
+            cover_children(*stack.back(), last_end);
+            stack.pop_back();
+        }
+    };
+
+    struct flat_builder {
+        flat_tree &tree;
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> last;
+
+        void add(node_type type, uint32_t token) {
+            auto parent = parents.empty() ? flat_tree::NONE : parents.back();
+            auto prev = last.empty() ? flat_tree::NONE : last.back();
+            auto cur = tree.add(type, token, parent, prev);
+            if (!last.empty()) {
+                last.back() = cur;
+            }
+        }
 
-static node parse_Y(const std::vector<token> &data, size_t &ind);
+        void open(node_type type, size_t) {
+            add(type, flat_tree::NONE);
+            parents.push_back(static_cast<uint32_t>(tree.size() - 1));
+            last.push_back(flat_tree::NONE);
+        }
 
-static node parse_F(const std::vector<token> &data, size_t &ind);
+        template <class Source>
+        void term(Source const &, size_t ind) {
+            add(TERM, static_cast<uint32_t>(ind));
+        }
 
+        void eps() {
+            add(EPS, flat_tree::NONE);
+        }
 
-static node parse_I(const std::vector<token> &data, size_t &ind);
+        void close() {
+            parents.pop_back();
+            last.pop_back();
+        }
+    };
+}
 
-static node parse_A(const std::vector<token> &data, size_t &ind);
+namespace {
+    // Interns every subtree as soon as it is closed, so repeats collapse while parsing.
+    struct dag_builder {
+        node_dag &dag;
+        std::vector<node_type> types;
+        std::vector<size_t> starts;
+        std::vector<node_dag::id> done;
+
+        void open(node_type type, size_t) {
+            types.push_back(type);
+            starts.push_back(done.size());
+        }
 
-static node parse_H(const std::vector<token> &data, size_t &ind);
+        template <class Source>
+        void term(Source const &data, size_t ind) {
+            done.push_back(dag.intern_term(data.type(ind), data.text(ind)));
+        }
 
-static node parse_B(const std::vector<token> &data, size_t &ind);
+        void eps() {
+            done.push_back(dag.intern(EPS, node_dag::NONE, nullptr, 0));
+        }
 
-static node parse_K(const std::vector<token> &data, size_t &ind);
+        void close() {
+            auto start = starts.back();
+            auto res = dag.intern(types.back(), node_dag::NONE, done.data() + start, done.size() - start);
+            done.resize(start);
+            done.push_back(res);
+            types.pop_back();
+            starts.pop_back();
+        }
+    };
+}
 
+namespace {
+    // Folds the E/X/T/Y/F events into operator nodes as soon as both operands are known.
+    struct ast_builder {
+        struct frame {
+            node_type type;
+            ast_type op;
+            uint32_t value;
+            size_t owner;
+        };
+
+        ast &tree;
+        std::vector<frame> stack;
+
+        void open(node_type type, size_t) {
+            size_t owner = stack.size();
+            if ((type == X || type == Y) && (stack.back().type == X || stack.back().type == Y)) {
+                owner = stack.back().owner;
+            } else if (type == X || type == Y) {
+                owner = stack.size() - 1;
+            }
+            stack.push_back({type, ast_type::Num, ast::NONE, owner});
+        }
 
-static node parse_E(const std::vector<token> &data, size_t &ind) {
-    node res(E);
-    auto const &cur = data[ind];
-    if (in_list(cur.type, {LEFT_PARENTHESIS, MINUS, NUMBER, PLUS})) {
-        res.children.push_back(parse_T(data, ind));
+        template <class Source>
+        void term(Source const &data, size_t ind) {
+            auto &top = stack.back();
+            switch (data.type(ind)) {
+                case NUMBER: {
+                    top.value = tree.add(ast_type::Num, static_cast<uint32_t>(ind));
+                    break;
+                }
+                case IDENTIFIER: {
+                    top.value = tree.add(ast_type::Var, static_cast<uint32_t>(ind));
+                    break;
+                }
+                case PLUS: {
+                    top.op = (top.type == F) ? ast_type::Pos : ast_type::Add;
+                    break;
+                }
+                case MINUS: {
+                    top.op = (top.type == F) ? ast_type::Neg : ast_type::Sub;
+                    break;
+                }
+                case MUL: {
+                    top.op = ast_type::Mul;
+                    break;
+                }
+                default: {
+                    break;
+                }
+            }
+        }
 
-        res.children.push_back(parse_X(data, ind));
-    } else {
-        throw parser_exception(data, ind, {LEFT_PARENTHESIS, MINUS, NUMBER, PLUS});
-    }
-    return res;
+        void eps() {}
+
+        void close() {
+            auto cur = stack.back();
+            stack.pop_back();
+            if (cur.type == X || cur.type == Y) {
+                return;
+            }
+            auto value = cur.value;
+            if (cur.type == F && cur.op != ast_type::Num) {
+                value = tree.add(cur.op, value);
+            }
+            if (stack.empty()) {
+                tree.set_root(value);
+                return;
+            }
+            auto &parent = stack.back();
+            if (parent.type == X || parent.type == Y) {
+                auto &owner = stack[parent.owner];
+                owner.value = tree.add(parent.op, owner.value, value);
+            } else {
+                parent.value = value;
+            }
+        }
+    };
 }
 
-static node parse_X(const std::vector<token> &data, size_t &ind) {
-    node res(X);
-    auto const &cur = data[ind];
-    if (in_list(cur.type, {PLUS})) {
-        res.children.emplace_back(TERM, cur);
-        ++ind;
+namespace {
+    // Passes the nodes of ll_parse() on to out, enforcing the limits and counting them for
+    // the statistics; ind is the driver's position in the tokens.
+    template <class Builder>
+    struct limited_builder {
+        Builder &out;
+        parse_limits const &limits;
+        size_t const &ind;
+        size_t depth = 0;
+        size_t nodes = 0;
+        PARSER_STATS_ONLY(node_counter counted;)
+
+        void count(size_t position) {
+            if (++nodes > limits.max_nodes) {
+                throw parser_exception("Parse tree size limit of " + std::to_string(limits.max_nodes)
+                                       + " nodes exceeded at position " + std::to_string(position));
+            }
+        }
 
-        res.children.push_back(parse_T(data, ind));
+        void open(node_type type, size_t size) {
+            if (++depth > limits.max_depth) {
+                throw parser_exception("Parse tree depth limit of " + std::to_string(limits.max_depth)
+                                       + " exceeded at position " + std::to_string(ind));
+            }
+            PARSER_STATS_ONLY(counted.add(type, depth);)
+            out.open(type, size);
+            count(ind);
+        }
 
-        res.children.push_back(parse_X(data, ind));
-    } else if (in_list(cur.type, {MINUS})) {
-        res.children.emplace_back(TERM, cur);
-        ++ind;
+        void close() {
+            out.close();
+            --depth;
+        }
 
-        res.children.push_back(parse_T(data, ind));
+        void eps() {
+            PARSER_STATS_ONLY(counted.add(EPS);)
+            out.eps();
+            count(ind);
+        }
+
+        template <class Source>
+        void term(Source const &data, size_t i) {
+            PARSER_STATS_ONLY(counted.add(TERM);)
+            out.term(data, i);
+            count(i + 1);
+        }
+    };
+}
+
+// Runs ll_parse() from `start` and returns the number of nodes built. The pending symbols
+// live on a heap-allocated stack, so nesting depth is bounded by the limits rather than by
+// the native stack.
+template <class Source, class Builder>
+static size_t parse_symbol(Source const &data, size_t &ind, Builder &out, node_type start, parse_limits const &limits) {
+    using namespace grammar;
+    std::vector<symbol> stack{{NONTERMINAL, static_cast<uint8_t>(start)}};
+    limited_builder<Builder> limited{out, limits, ind};
+    ll_parse(data, ind, stack, limited, [&data](size_t i, symbol top) {
+        if (top.kind == TERMINAL) {
+            data.fail(i, {static_cast<token_type>(top.value)});
+        }
+        auto const &first = expected[top.value];
+        data.fail(i, std::vector<token_type>(first.data, first.data + first.size));
+    });
+    return limited.nodes;
+}
 
-        res.children.push_back(parse_X(data, ind));
-    } else if (in_list(cur.type, {END, RIGHT_PARENTHESIS})) {
-        res.children.emplace_back(EPS);
-    } else {
-        throw parser_exception(data, ind, {PLUS, MINUS, END, RIGHT_PARENTHESIS});
+template <class Source, class Builder>
+static void parse_all(Source const &data, Builder &out, parse_limits const &limits) {
+    PARSER_STATS_PHASE(PHASE_PARSE);
+    size_t ind = 0;
+    parse_symbol(data, ind, out, grammar::start, limits);
+    if (data.type(ind) != END) {
+        data.fail(ind, {END});
     }
+}
+
+template <class Source>
+static node parse_all(Source const &data, std::pmr::memory_resource *resource, parse_limits const &limits) {
+    node_builder out;
+    out.resource = resource;
+    parse_all(data, out, limits);
+    return std::move(*out.root);
+}
+
+node parse(const std::vector<token> &data, parse_limits limits) {
+    return parse(data, std::pmr::get_default_resource(), limits);
+}
+
+node parse(token_buffer const &data, parse_limits limits) {
+    return parse(data, std::pmr::get_default_resource(), limits);
+}
+
+node parse(token_stream &data, parse_limits limits) {
+    return parse(data, std::pmr::get_default_resource(), limits);
+}
+
+node parse(std::vector<token> const &data, std::pmr::memory_resource *resource, parse_limits limits) {
+    return parse_all(vector_source<std::vector<token>>{data}, resource, limits);
+}
+
+node parse(std::pmr::vector<token> const &data, std::pmr::memory_resource *resource, parse_limits limits) {
+    return parse_all(vector_source<std::pmr::vector<token>>{data}, resource, limits);
+}
+
+node parse(token_buffer const &data, std::pmr::memory_resource *resource, parse_limits limits) {
+    return parse_all(buffer_source{data}, resource, limits);
+}
+
+node parse(token_stream &data, std::pmr::memory_resource *resource, parse_limits limits) {
+    return parse_all(stream_source{data}, resource, limits);
+}
+
+flat_tree parse_flat(token_buffer data, parse_limits limits) {
+    flat_tree res(std::move(data));
+    parse_flat(res, limits);
     return res;
 }
 
-static node parse_T(const std::vector<token> &data, size_t &ind) {
-    node res(T);
-    auto const &cur = data[ind];
-    if (in_list(cur.type, {LEFT_PARENTHESIS, MINUS, NUMBER, PLUS})) {
-        res.children.push_back(parse_F(data, ind));
+void parse_flat(flat_tree &tree, parse_limits limits) {
+    tree.reset(tree.release_tokens());
+    flat_builder out{tree, {}, {}};
+    parse_all(buffer_source{tree.tokens()}, out, limits);
+}
 
-        res.children.push_back(parse_Y(data, ind));
-    } else {
-        throw parser_exception(data, ind, {LEFT_PARENTHESIS, MINUS, NUMBER, PLUS});
-    }
+ast parse_ast(token_buffer data, parse_limits limits) {
+    ast res(std::move(data));
+    parse_ast(res, limits);
     return res;
 }
 
-static node parse_Y(const std::vector<token> &data, size_t &ind) {
-    node res(Y);
-    auto const &cur = data[ind];
-    if (in_list(cur.type, {MUL})) {
-        res.children.emplace_back(TERM, cur);
-        ++ind;
+void parse_ast(ast &tree, parse_limits limits) {
+    tree.reset(tree.release_tokens());
+    ast_builder out{tree, {}};
+    parse_all(buffer_source{tree.tokens()}, out, limits);
+}
 
-        res.children.push_back(parse_F(data, ind));
+node_dag::id parse_dag(token_buffer const &data, node_dag &dag, parse_limits limits) {
+    dag_builder out{dag, {}, {}, {}};
+    parse_all(buffer_source{data}, out, limits);
+    return out.done.back();
+}
 
-        res.children.push_back(parse_Y(data, ind));
-    } else if (in_list(cur.type, {END, MINUS, PLUS, RIGHT_PARENTHESIS})) {
-        res.children.emplace_back(EPS);
-    } else {
-        throw parser_exception(data, ind, {MUL, END, MINUS, PLUS, RIGHT_PARENTHESIS});
+// Splits the token stream at depth-0 binary '+'/'-' into the T operands of the
+// top-level X chain, parses the operands concurrently and links them back into
+// the E/X chain the sequential parser builds. Any malformed piece falls back to the
+// sequential parser, so errors are reported exactly as parse() reports them. Operand T_i
+// sits i + 1 levels below the root (T_0 one), so it is parsed with that much less depth,
+// and a tree that ends up over the limits is left to the sequential parser to reject.
+template <class Source>
+static node parse_parallel(Source const &data, thread_pool &pool, parse_limits const &limits) {
+    size_t n = data.size();
+    size_t chunks = std::min(n, (pool.size() + 1) * 4);
+    auto chunk_begin = [n, chunks](size_t i) {
+        return n * i / chunks;
+    };
+
+    std::vector<long long> depth(chunks + 1, 0);
+    std::vector<std::vector<size_t>> cuts(chunks);
+    std::atomic<bool> broken{false};
+    {
+        task_group group(pool);
+        for (size_t i = 0; i < chunks; ++i) {
+            group.run([&, i] {
+                long long cur = 0;
+                for (size_t j = chunk_begin(i); j < chunk_begin(i + 1); ++j) {
+                    cur += (data.type(j) == LEFT_PARENTHESIS) - (data.type(j) == RIGHT_PARENTHESIS);
+                }
+                depth[i + 1] = cur;
+            });
+        }
+        group.wait();
+        for (size_t i = 0; i < chunks; ++i) {
+            depth[i + 1] += depth[i];
+        }
+        for (size_t i = 0; i < chunks; ++i) {
+            group.run([&, i] {
+                long long cur = depth[i];
+                for (size_t j = chunk_begin(i); j < chunk_begin(i + 1); ++j) {
+                    auto type = data.type(j);
+                    cur += (type == LEFT_PARENTHESIS) - (type == RIGHT_PARENTHESIS);
+                    if (cur < 0) {
+                        broken = true;
+                        return;
+                    }
+                    if (cur == 0 && (type == PLUS || type == MINUS) && j > 0
+                        && (data.type(j - 1) == NUMBER || data.type(j - 1) == IDENTIFIER
+                            || data.type(j - 1) == RIGHT_PARENTHESIS)) {
+                        cuts[i].push_back(j);
+                    }
+                }
+            });
+        }
+        group.wait();
+    }
+    if (broken || depth[chunks] != 0 || n == 0 || data.type(n - 1) != END) {
+        return parse_all(data, std::pmr::get_default_resource(), limits);
+    }
+
+    std::vector<size_t> ops;
+    for (auto &&item : cuts) {
+        ops.insert(ops.end(), item.begin(), item.end());
+    }
+    std::vector<std::optional<node>> terms(ops.size() + 1);
+    // E, an X and an operator per operand after the first, and the final X and EPS.
+    std::atomic<size_t> nodes{2 * ops.size() + 3};
+    source_span last_end;
+    {
+        task_group group(pool);
+        size_t batch = (terms.size() + chunks - 1) / chunks;
+        for (size_t first = 0; first < terms.size(); first += batch) {
+            group.run([&, first] {
+                for (size_t i = first; i < std::min(first + batch, terms.size()); ++i) {
+                    size_t ind = i ? ops[i - 1] + 1 : 0;
+                    size_t stop = i < ops.size() ? ops[i] : n - 1;
+                    size_t above = i ? i + 1 : 1;
+                    if (above >= limits.max_depth) {
+                        broken = true;
+                        return;
+                    }
+                    try {
+                        node_builder out;
+                        nodes += parse_symbol(data, ind, out, T, {limits.max_depth - above, limits.max_nodes});
+                        if (ind != stop) {
+                            broken = true;
+                            return;
+                        }
+                        terms[i] = std::move(*out.root);
+                        if (i + 1 == terms.size()) {
+                            last_end = out.last_end;
+                        }
+                    } catch (parser_exception const &) {
+                        broken = true;
+                        return;
+                    }
+                }
+            });
+        }
+        group.wait();
+    }
+    if (broken || nodes > limits.max_nodes || ops.size() + 2 > limits.max_depth) {
+        return parse_all(data, std::pmr::get_default_resource(), limits);
     }
+
+    node tail(X, std::vector<node>{node(EPS)});
+    tail.children[0].span = last_end;
+    tail.span = last_end;
+    for (size_t i = ops.size(); i > 0; --i) {
+        std::vector<node> children;
+        children.reserve(3);
+        children.emplace_back(TERM, data.get(ops[i - 1]));
+        children.push_back(std::move(*terms[i]));
+        children.push_back(std::move(tail));
+        tail = node(X, std::move(children));
+        cover_children(tail, last_end);
+    }
+    std::vector<node> children;
+    children.reserve(2);
+    children.push_back(std::move(*terms[0]));
+    children.push_back(std::move(tail));
+    node res(E, std::move(children));
+    cover_children(res, last_end);
     return res;
 }
 
-static node parse_F(const std::vector<token> &data, size_t &ind) {
-    node res(F);
-    auto const &cur = data[ind];
-    if (in_list(cur.type, {MINUS, PLUS})) {
-        res.children.emplace_back(TERM, cur);
-        ++ind;
+node parse_parallel(std::vector<token> const &data, thread_pool &pool, parse_limits limits) {
+    return parse_parallel(vector_source<std::vector<token>>{data}, pool, limits);
+}
 
-        res.children.push_back(parse_F(data, ind));
-    } else if (in_list(cur.type, {NUMBER})) {
-        res.children.emplace_back(TERM, cur);
-        ++ind;
-    } else if (in_list(cur.type, {LEFT_PARENTHESIS})) {
-        res.children.emplace_back(TERM, cur);
-        ++ind;
+node parse_parallel(token_buffer const &data, thread_pool &pool, parse_limits limits) {
+    return parse_parallel(buffer_source{data}, pool, limits);
+}
 
-        res.children.push_back(parse_E(data, ind));
+node parse_parallel(std::vector<token> const &data, size_t threads, parse_limits limits) {
+    thread_pool pool(std::max<size_t>(threads, 1) - 1);
+    return parse_parallel(data, pool, limits);
+}
+
+node parse_parallel(token_buffer const &data, size_t threads, parse_limits limits) {
+    thread_pool pool(std::max<size_t>(threads, 1) - 1);
+    return parse_parallel(data, pool, limits);
+}
 
-        if (data[ind].type != RIGHT_PARENTHESIS) {
-            throw parser_exception(data, ind, {RIGHT_PARENTHESIS});
+struct text_position {
+    uint32_t line;
+    uint32_t column;
+};
+
+static text_position advance_position(text_position pos, std::string_view text) {
+    for (char c : text) {
+        if (c == '\n') {
+            ++pos.line;
+            pos.column = 1;
+        } else {
+            ++pos.column;
         }
+    }
+    return pos;
+}
+
+static bool is_digit(char c) {
+    return '0' <= c && c <= '9';
+}
 
-        res.children.emplace_back(TERM, data[ind]);
-        ++ind;
-    } else {
-        throw parser_exception(data, ind, {LEFT_PARENTHESIS, NUMBER, MINUS});
+// Moves a span lexed from a region that starts at `base` to absolute coordinates.
+static void translate_span(source_span &span, source_span const &base) {
+    if (span.line == 1) {
+        span.column += base.column - 1;
     }
-    return res;
+    span.line += base.line - 1;
+    span.offset += base.offset;
 }
 
-node parse(const std::vector<token> &data) {
-    size_t ind = 0;
-    auto&& res = parse_E(data, ind);
-    if (data[ind].type != END) {
-        throw parser_exception(data, ind, {END});
+static void translate_spans(node &root, source_span const &base) {
+    std::vector<node *> stack{&root};
+    while (!stack.empty()) {
+        auto cur = stack.back();
+        stack.pop_back();
+        auto &span = cur->span;
+        translate_span(span, base);
+        if (cur->data) {
+            cur->data->span = span;
+        }
+        for (auto &&item : cur->children) {
+            stack.push_back(&item);
+        }
     }
-    return res;
 }
 
-node parse(std::istream &in) {
-    return parse(tokenize(in));
+editable_tree::editable_tree(std::string const &source, parse_limits limits)
+        : text(source), root(parse(source, limits)), limits(limits) {}
+
+void editable_tree::add_shift(node &cur, shift const &s) {
+    if (!cur.children.empty()) {
+        auto it = pending.find(&cur);
+        if (it == pending.end()) {
+            // Descendants start on the node's line or later, so only that line can be the anchor.
+            pending.emplace(&cur, shift{s.offset, s.line, cur.span.line == s.anchor ? s.column : 0, cur.span.line});
+        } else {
+            auto &t = it->second;
+            if (static_cast<int64_t>(s.anchor) - t.line == t.anchor) {
+                t.column += s.column;
+            }
+            t.offset += s.offset;
+            t.line += s.line;
+        }
+    }
+    auto &span = cur.span;
+    span.offset = static_cast<size_t>(static_cast<ptrdiff_t>(span.offset) + s.offset);
+    if (span.line == s.anchor) {
+        span.column = static_cast<uint32_t>(span.column + s.column);
+    }
+    span.line = static_cast<uint32_t>(span.line + s.line);
+    if (cur.data) {
+        cur.data->span = span;
+    }
+}
+
+void editable_tree::push_down(node &cur) {
+    auto it = pending.find(&cur);
+    if (it == pending.end()) {
+        return;
+    }
+    auto s = it->second;
+    pending.erase(it);
+    for (auto &&item : cur.children) {
+        add_shift(item, s);
+    }
+}
+
+void editable_tree::forget(node const &subtree) {
+    if (pending.empty()) {
+        return;
+    }
+    std::vector<node const *> stack{&subtree};
+    while (!stack.empty()) {
+        auto cur = stack.back();
+        stack.pop_back();
+        if (!cur->children.empty()) {
+            pending.erase(cur);
+            for (auto &&item : cur->children) {
+                stack.push_back(&item);
+            }
+        }
+    }
+}
+
+node const &editable_tree::tree() {
+    if (pending.empty()) {
+        return root;
+    }
+    std::vector<node *> stack{&root};
+    while (!stack.empty()) {
+        auto cur = stack.back();
+        stack.pop_back();
+        push_down(*cur);
+        for (auto &&item : cur->children) {
+            stack.push_back(&item);
+        }
+    }
+    return root;
+}
+
+void editable_tree::apply(text_edit const &edit) {
+    if (edit.offset > text.size() || edit.removed > text.size() - edit.offset) {
+        throw std::out_of_range("Edit range is outside the source");
+    }
+    auto edit_end = edit.offset + edit.removed;
+    // Ancestors of the edit, outermost first, with current spans down to their children.
+    std::vector<node *> path;
+    for (node *cur = &root; cur;) {
+        auto const &span = cur->span;
+        if (span.offset > edit.offset || span.offset + span.length < edit_end || !span.length) {
+            break;
+        }
+        path.push_back(cur);
+        push_down(*cur);
+        node *next = nullptr;
+        for (auto &&item : cur->children) {
+            if (item.span.offset <= edit.offset && edit_end <= item.span.offset + item.span.length && item.span.length) {
+                next = &item;
+                break;
+            }
+        }
+        cur = next;
+    }
+
+    std::string removed = text.substr(edit.offset, edit.removed);
+    text.replace(edit.offset, edit.removed, edit.inserted);
+    auto delta = static_cast<ptrdiff_t>(edit.inserted.size()) - static_cast<ptrdiff_t>(edit.removed);
+    for (size_t k = path.size(); k-- > 0;) {
+        auto &cand = *path[k];
+        if (cand.type != E && cand.type != T && cand.type != F) {
+            continue;
+        }
+        auto begin = cand.span.offset;
+        auto old_end = begin + cand.span.length;
+        auto end = static_cast<size_t>(static_cast<ptrdiff_t>(old_end) + delta);
+        // A region glued to a neighbouring number would lex differently in context.
+        if (end <= begin || (begin > 0 && is_digit(text[begin - 1]) && is_digit(text[begin]))
+            || (end < text.size() && is_digit(text[end - 1]) && is_digit(text[end]))) {
+            continue;
+        }
+        auto region = text.substr(begin, end - begin);
+        node sub(cand.type);
+        source_span new_end;
+        try {
+            auto tokens = tokenize_buffer(region);
+            buffer_source data{tokens};
+            size_t ind = 0;
+            node_builder out;
+            parse_symbol(data, ind, out, cand.type, limits);
+            if (data.type(ind) != END) {
+                continue;
+            }
+            sub = std::move(*out.root);
+            new_end = out.last_end;
+        } catch (lexer_exception const &) {
+            continue;
+        } catch (parser_exception const &) {
+            continue;
+        }
+        translate_spans(sub, cand.span);
+        translate_span(new_end, cand.span);
+
+        // Everything after the old region moves by delta and possibly to other lines. The
+        // old region is the new one with the edit undone.
+        std::string_view view(region);
+        auto prefix = advance_position({cand.span.line, cand.span.column}, view.substr(0, edit.offset - begin));
+        auto suffix = view.substr(edit.offset - begin + edit.inserted.size());
+        auto old_pos = advance_position(advance_position(prefix, removed), suffix);
+        auto new_pos = advance_position(advance_position(prefix, edit.inserted), suffix);
+        shift moved{delta, static_cast<int64_t>(new_pos.line) - old_pos.line,
+                    static_cast<int64_t>(new_pos.column) - old_pos.column, old_pos.line};
+        for (size_t i = 0; i < k; ++i) {
+            for (auto &&item : path[i]->children) {
+                if (&item == path[i + 1] || item.span.offset < old_end) {
+                    continue;
+                }
+                if (item.span.length || item.span.offset != old_end) {
+                    add_shift(item, moved);
+                    continue;
+                }
+                // Empty subtrees sit where the reparsed region now ends.
+                forget(item);
+                std::vector<node *> stack{&item};
+                while (!stack.empty()) {
+                    auto cur = stack.back();
+                    stack.pop_back();
+                    cur->span = new_end;
+                    for (auto &&child : cur->children) {
+                        stack.push_back(&child);
+                    }
+                }
+            }
+        }
+        forget(cand);
+        cand = std::move(sub);
+        for (size_t i = k; i-- > 0;) {
+            cover_children(*path[i], path[i]->span);
+        }
+        return;
+    }
+    try {
+        root = parse(text.str(), limits);
+    } catch (...) {
+        text.replace(edit.offset, edit.inserted.size(), removed);
+        throw;
+    }
+    pending.clear();
+}
+
+node parse(std::istream &in, parse_limits limits) {
+    return parse(tokenize_buffer(in), limits);
+}
+
+node parse(std::string const &s, parse_limits limits) {
+    return parse(tokenize_buffer(s), limits);
 }
 
-node parse(std::string const &s) {
-    return parse(tokenize(s));
+node parse(std::istream &in, std::pmr::memory_resource *resource, parse_limits limits) {
+    return parse(tokenize_buffer(in), resource, limits);
+}
+
+node parse(std::string const &s, std::pmr::memory_resource *resource, parse_limits limits) {
+    return parse(tokenize_buffer(s), resource, limits);
 }
 
 std::string to_string(node_type x) {
@@ -176,19 +847,25 @@ std::string to_string(node_type x) {
 }
 
 bool operator==(node const &a, node const &b) {
-    if (a.type != b.type) {
-        return false;
-    }
-    if (a.type == TERM) {
-        return (a.data == b.data);
-    }
-    if (a.children.size() != b.children.size()) {
-        return false;
-    }
-    for (size_t i = 0; i < a.children.size(); ++i) {
-        if (!(a.children[i] == b.children[i])) {
+    std::vector<std::pair<node const *, node const *>> stack{{&a, &b}};
+    while (!stack.empty()) {
+        auto [x, y] = stack.back();
+        stack.pop_back();
+        if (x->type != y->type) {
             return false;
         }
+        if (x->type == TERM) {
+            if (x->data != y->data) {
+                return false;
+            }
+            continue;
+        }
+        if (x->children.size() != y->children.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < x->children.size(); ++i) {
+            stack.emplace_back(&x->children[i], &y->children[i]);
+        }
     }
     return true;
 }
@@ -197,66 +874,144 @@ bool operator!=(node const &a, node const &b) {
     return !(a == b);
 }
 
-parser_exception::parser_exception(std::vector<token> const &data, size_t pos,
-                                   std::initializer_list<token_type> expected) {
+static std::string make_reason(token_type found, size_t pos, source_span const &where, std::string_view before,
+                               std::string_view at, uint32_t column, std::vector<token_type> const &expected) {
     std::ostringstream os;
-    os << "Unexpected token " << data[pos].type << " at position " << pos << ":\n";
-    size_t cnt = 0;
-    for (size_t i = 0; i < pos; ++i) {
-        os << data[i].data << ' ';
-        cnt += data[i].data.size() + 1;
-    }
-    os << data[pos].data << '\n';
-    for (size_t i = 0; i < cnt; ++i) {
-        os.put(' ');
-    }
-    os.put('^');
-    for (size_t i = 1; i < data[pos].data.size(); ++i) {
-        os.put('~');
-    }
-    os << "\nExpected: ";
+    os << "Unexpected token " << found << " at position " << pos
+       << " (line " << where.line << ", column " << where.column << "):\n";
+    std::string excerpt;
+    append_excerpt(excerpt, before, at, column);
+    os << excerpt << "\nExpected: ";
     for (auto x : expected) {
         os << x << " ";
     }
-    reason = os.str();
+    return os.str();
 }
 
-std::string node::to_json() const {
-    return to_json_inner().dump(2);
+// Without the source text, the tokens before the error are quoted separated by spaces.
+template <class Vector>
+static std::string vector_reason(Vector const &data, size_t pos, std::vector<token_type> const &expected) {
+    size_t from = pos;
+    size_t width = 0;
+    while (from > 0 && width + data[from - 1].data.size() + 1 <= DIAGNOSTIC_WINDOW) {
+        --from;
+        width += data[from].data.size() + 1;
+    }
+    std::string before;
+    before.reserve(width);
+    for (size_t i = from; i < pos; ++i) {
+        before.append(data[i].data);
+        before.push_back(' ');
+    }
+    auto column = static_cast<uint32_t>(before.size() + (from > 0 ? 2 : 1));
+    return make_reason(data[pos].type, pos, data[pos].span, before, data[pos].data, column, expected);
 }
 
-node::json node::to_json_inner() const {
-    switch (type) {
-        case EPS: {
-            return ::to_string(EPS);
-        }
-        case TERM: {
-            return data->data;
-        }
-        default: {
-            json tmp;
-            for (auto &&item : children) {
-                tmp.push_back(item.to_json_inner());
+parser_exception::parser_exception(std::vector<token> const &data, size_t pos,
+                                   std::vector<token_type> const &expected)
+        : reason(vector_reason(data, pos, expected)) {}
+
+parser_exception::parser_exception(std::pmr::vector<token> const &data, size_t pos,
+                                   std::vector<token_type> const &expected)
+        : reason(vector_reason(data, pos, expected)) {}
+
+parser_exception::parser_exception(token_buffer const &data, size_t pos,
+                                   std::vector<token_type> const &expected) {
+    auto where = data.span(pos);
+    auto from = where.offset - std::min<size_t>(where.column - 1, DIAGNOSTIC_WINDOW);
+    auto before = std::string_view(data.source()).substr(from, where.offset - from);
+    reason = make_reason(data.type(pos), pos, where, before, data.text(pos), where.column, expected);
+}
+
+parser_exception::parser_exception(std::string reason) : reason(std::move(reason)) {}
+
+parser_exception::parser_exception(token const &found, std::string_view before, size_t pos,
+                                   std::vector<token_type> const &expected)
+        : reason(make_reason(found.type, pos, found.span, before, found.data, found.span.column, expected)) {}
+
+std::string node::to_json(int indent) const {
+    std::string res;
+    to_json(res, indent);
+    return res;
+}
+
+void node::to_json(std::string &out, int indent) const {
+    PARSER_STATS_PHASE(PHASE_SERIALIZE);
+    json_writer writer(out, indent);
+    write_json(writer);
+}
+
+void node::to_json(std::ostream &out, int indent) const {
+    PARSER_STATS_PHASE(PHASE_SERIALIZE);
+    json_writer writer(out, indent);
+    write_json(writer);
+}
+
+void node::write_json(json_writer &out) const {
+    std::vector<std::pair<node const *, size_t>> stack;
+    auto open = [&out, &stack](node const &cur) {
+        switch (cur.type) {
+            case EPS: {
+                out.value(::to_string(EPS));
+                break;
+            }
+            case TERM: {
+                out.value(cur.data->data);
+                break;
             }
-            return { {::to_string(type), tmp} };
+            default: {
+                if (cur.children.empty()) {
+                    out.empty_node(::to_string(cur.type));
+                } else {
+                    out.begin_node(::to_string(cur.type));
+                    stack.emplace_back(&cur, 0);
+                }
+            }
+        }
+    };
+    open(*this);
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (top.second == top.first->children.size()) {
+            out.end_node();
+            stack.pop_back();
+        } else {
+            open(top.first->children[top.second++]);
         }
     }
 }
 
 std::string node::to_string() const {
-    switch (type) {
-        case EPS: {
-            return "";
-        }
-        case TERM: {
-            return data->data;
-        }
-        default: {
-            std::string ans;
-            for (auto && item : children) {
-                ans.append(item.to_string());
-            }
-            return ans;
+    return render(*this, RENDER_VERBATIM);
+}
+
+node::node(node const &other, allocator_type alloc)
+        : type(other.type), children(other.children, alloc), span(other.span) {
+    if (other.data) {
+        data.emplace(*other.data, alloc);
+    }
+}
+
+node::node(node &&other, allocator_type alloc)
+        : type(other.type), children(std::move(other.children), alloc), span(other.span) {
+    if (other.data) {
+        data.emplace(std::move(*other.data), alloc);
+    }
+}
+
+node::~node() {
+    if (children.empty()) {
+        return;
+    }
+    // A plain vector moves the subtrees without touching their resource.
+    std::vector<node> pending(std::make_move_iterator(children.begin()), std::make_move_iterator(children.end()));
+    children.clear();
+    while (!pending.empty()) {
+        node cur = std::move(pending.back());
+        pending.pop_back();
+        for (auto &&item : cur.children) {
+            pending.push_back(std::move(item));
         }
+        cur.children.clear();
     }
 }
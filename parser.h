@@ -4,9 +4,19 @@
 #include <sstream>
 #include <memory>
 #include <optional>
-#include <json.h>
+#include <unordered_map>
+#include "gap_buffer.h"
 #include "lexer.h"
 
+class json_writer;
+class thread_pool;
+
+
+enum node_type {
+    E, X, T, Y, F, TERM, EPS
+};
+
+std::string to_string(node_type x);
 
 class parser_exception : public std::exception {
     std::string reason;
@@ -15,37 +25,198 @@ public:
         return reason.c_str();
     }
 
-    parser_exception(std::vector<token> const& data, size_t pos, std::initializer_list<token_type> expected);
+    parser_exception(std::vector<token> const& data, size_t pos, std::vector<token_type> const& expected);
+    parser_exception(std::pmr::vector<token> const& data, size_t pos, std::vector<token_type> const& expected);
+    parser_exception(token_buffer const& data, size_t pos, std::vector<token_type> const& expected);
+    parser_exception(token const& found, std::string_view before, size_t pos, std::vector<token_type> const& expected);
+    explicit parser_exception(std::string reason);
 };
 
-enum node_type {
-    E, X, T, Y, F, TERM, EPS
+struct parse_limits {
+    size_t max_depth = SIZE_MAX;
+    size_t max_nodes = SIZE_MAX;
 };
 
-std::string to_string(node_type x);
 
+// Children and token literals are allocated from the node's memory resource, so a whole
+// tree can live in one arena; the default resource is used unless one is given.
 struct node {
+    using allocator_type = std::pmr::polymorphic_allocator<node>;
+
     node_type type;
     std::optional<token> data;
-    std::vector<node> children;
+    std::pmr::vector<node> children;
+    // Source text covered by the node; empty subtrees sit where the preceding text ends.
+    source_span span;
 
+    node(node_type _type, allocator_type alloc = {}) : type(_type), children(alloc) {}
+    node(node_type _type, std::vector<node> _children, allocator_type alloc = {})
+            : type(_type), children(std::make_move_iterator(_children.begin()),
+                                    std::make_move_iterator(_children.end()), alloc) {}
+    node(node_type _type, token _data, allocator_type alloc = {})
+            : type(_type), data(std::in_place, std::move(_data), alloc), children(alloc), span(data->span) {}
 
-    node(node_type _type) : type(_type) {}
-    node(node_type _type, std::vector<node> _children) : type(_type), children(std::move(_children)) {}
-    node(node_type _type, token const& _data) : type(_type), data(_data), children() {}
+    node(node const&) = default;
+    node(node&&) = default;
+    node& operator=(node const&) = default;
+    node& operator=(node&&) = default;
+    ~node();
+
+    node(node const& other, allocator_type alloc);
+    node(node&& other, allocator_type alloc);
+
+    allocator_type get_allocator() const {
+        return children.get_allocator();
+    }
 
-    std::string to_json() const;
+    std::string to_json(int indent = 2) const;
+    void to_json(std::string& out, int indent = 2) const;
+    void to_json(std::ostream& out, int indent = 2) const;
     std::string to_string() const;
 private:
-    using json = nlohmann::json;
-
-    json to_json_inner() const;
+    void write_json(json_writer& out) const;
 };
 
 bool operator==(node const& a, node const& b);
 bool operator!=(node const& a, node const& b);
 
+// Parse tree laid out in preorder inside a single arena: a type column and
+// first-child/next-sibling/token-index columns. TERM nodes refer to the owned tokens.
+class flat_tree {
+    token_buffer toks;
+    std::unique_ptr<unsigned char[]> arena;
+    uint8_t *types = nullptr;
+    uint32_t *first = nullptr;
+    uint32_t *next = nullptr;
+    uint32_t *tok = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+
+    void allocate(size_t cap);
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    explicit flat_tree(token_buffer tokens = token_buffer());
+
+    flat_tree(flat_tree&&) = default;
+    flat_tree& operator=(flat_tree&&) = default;
+
+    // Drops the nodes and takes new tokens, keeping the arena when it is large enough.
+    void reset(token_buffer tokens);
+    token_buffer release_tokens();
+
+    uint32_t add(node_type type, uint32_t token, uint32_t parent, uint32_t prev_sibling);
+
+    size_t size() const {
+        return count;
+    }
+
+    node_type type(uint32_t i) const {
+        return static_cast<node_type>(types[i]);
+    }
+
+    uint32_t first_child(uint32_t i) const {
+        return first[i];
+    }
+
+    uint32_t next_sibling(uint32_t i) const {
+        return next[i];
+    }
+
+    uint32_t token_index(uint32_t i) const {
+        return tok[i];
+    }
+
+    std::string_view text(uint32_t i) const {
+        return toks.text(tok[i]);
+    }
+
+    token_buffer const& tokens() const {
+        return toks;
+    }
+
+    std::string to_json(int indent = 2) const;
+    void to_json(std::string& out, int indent = 2) const;
+    std::string to_string() const;
+    node to_node() const;
+};
+
+bool operator==(flat_tree const& a, flat_tree const& b);
+bool operator!=(flat_tree const& a, flat_tree const& b);
+
+
+node parse(const std::vector<token> &data, parse_limits limits = parse_limits());
+node parse(token_buffer const& data, parse_limits limits = parse_limits());
+node parse(token_stream& data, parse_limits limits = parse_limits());
+node parse(std::istream& in, parse_limits limits = parse_limits());
+node parse(std::string const& s, parse_limits limits = parse_limits());
+
+// Build the tree in resource; with a monotonic resource it is released all at once.
+node parse(std::vector<token> const& data, std::pmr::memory_resource* resource, parse_limits limits = parse_limits());
+node parse(std::pmr::vector<token> const& data, std::pmr::memory_resource* resource,
+           parse_limits limits = parse_limits());
+node parse(token_buffer const& data, std::pmr::memory_resource* resource, parse_limits limits = parse_limits());
+node parse(token_stream& data, std::pmr::memory_resource* resource, parse_limits limits = parse_limits());
+node parse(std::istream& in, std::pmr::memory_resource* resource, parse_limits limits = parse_limits());
+node parse(std::string const& s, std::pmr::memory_resource* resource, parse_limits limits = parse_limits());
 
-node parse(const std::vector<token> &data);
-node parse(std::istream& in);
-node parse(std::string const& s);
+// Parses the operands of the top-level sum on the pool; the calling thread takes part.
+// The result and the errors are those of parse(). The overloads taking a thread count
+// start a pool of threads - 1 workers for the call.
+node parse_parallel(std::vector<token> const& data, thread_pool& pool, parse_limits limits = parse_limits());
+node parse_parallel(token_buffer const& data, thread_pool& pool, parse_limits limits = parse_limits());
+node parse_parallel(std::vector<token> const& data, size_t threads, parse_limits limits = parse_limits());
+node parse_parallel(token_buffer const& data, size_t threads, parse_limits limits = parse_limits());
+
+flat_tree parse_flat(token_buffer data, parse_limits limits = parse_limits());
+void parse_flat(flat_tree& tree, parse_limits limits = parse_limits());
+
+// Replaces source[offset, offset + removed) with inserted.
+struct text_edit {
+    size_t offset;
+    size_t removed;
+    std::string inserted;
+};
+
+// A source text and its parse tree, kept equal to a full parse of the text across edits.
+// An edit relexes and reparses only the smallest E/T/F subtree covering it. The text is
+// a gap buffer and the spans after the edit are shifted lazily, a pending shift per
+// subtree that is pushed down as later edits walk through it, so an edit costs about the
+// size of the reparsed subtree plus the depth of the tree; tree() settles the shifts.
+// Chains are not indexed: every X or Y before the edited operand of a chain is on the
+// path, so in a flat sum or product an edit still costs O(position in the chain).
+class editable_tree {
+    // Moves spans by offset and line; spans on line `anchor` also move by column.
+    struct shift {
+        ptrdiff_t offset;
+        int64_t line;
+        int64_t column;
+        uint32_t anchor;
+    };
+
+    gap_buffer text;
+    node root;
+    parse_limits limits;
+    // Shifts still to be applied to the descendants of a node, whose own span is current.
+    std::unordered_map<node const*, shift> pending;
+
+    void add_shift(node& cur, shift const& s);
+    void push_down(node& cur);
+    void forget(node const& subtree);
+public:
+    explicit editable_tree(std::string const& source, parse_limits limits = parse_limits());
+
+    // If the new source doesn't parse, the exception of a full parse is thrown and
+    // nothing changes.
+    void apply(text_edit const& edit);
+
+    size_t size() const {
+        return text.size();
+    }
+
+    std::string source() const {
+        return text.str();
+    }
+
+    node const& tree();
+};
@@ -0,0 +1,210 @@
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "render.h"
+
+namespace {
+    // How tightly a subexpression binds, and how tightly the position it is in requires
+    // it to: a parenthesized E is written without its parentheses when it binds at least
+    // as tightly as its position needs.
+    enum binding : uint8_t {
+        SUM = 1, PRODUCT = 2, UNARY = 3
+    };
+
+    enum term_style : uint8_t {
+        PLAIN, BINARY, HIDDEN
+    };
+
+    struct frame {
+        node const *cur;
+        binding required;
+        term_style style;
+    };
+
+    bool is_empty(node const &suffix) {
+        return suffix.children.empty() || suffix.children[0].type == EPS;
+    }
+
+    // Follows E -> T with an empty X, T -> F with an empty Y and F -> ( E ) down to the
+    // first node that decides the binding.
+    binding binding_of(node const *e) {
+        while (true) {
+            if (!is_empty(e->children[1])) {
+                return SUM;
+            }
+            auto const &t = e->children[0];
+            if (!is_empty(t.children[1])) {
+                return PRODUCT;
+            }
+            auto const &f = t.children[0];
+            if (f.children.size() != 3) {
+                return UNARY;
+            }
+            e = &f.children[1];
+        }
+    }
+
+    std::string_view binary_text(token const &op) {
+        switch (op.type) {
+            case PLUS: {
+                return " + ";
+            }
+            case MINUS: {
+                return " - ";
+            }
+            case MUL: {
+                return " * ";
+            }
+            default: {
+                return op.data;
+            }
+        }
+    }
+
+    // Calls sink with the pieces of the output in order.
+    template <class Sink>
+    void walk(node const &tree, render_mode mode, Sink &sink) {
+        std::vector<frame> stack{{&tree, SUM, PLAIN}};
+        auto push = [&stack](node const &cur, binding required, term_style style = PLAIN) {
+            stack.push_back({&cur, required, style});
+        };
+        while (!stack.empty()) {
+            auto top = stack.back();
+            stack.pop_back();
+            auto const &cur = *top.cur;
+            auto const &children = cur.children;
+            // Verbatim output needs no structure, so any tree of TERM leaves will do.
+            auto type = mode == RENDER_VERBATIM && cur.type != TERM ? EPS : cur.type;
+            if (type == EPS) {
+                for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                    push(*it, SUM);
+                }
+                continue;
+            }
+            switch (type) {
+                case TERM: {
+                    if (top.style == HIDDEN) {
+                        break;
+                    }
+                    sink(top.style == BINARY ? binary_text(*cur.data) : std::string_view(cur.data->data));
+                    break;
+                }
+                case E: {
+                    // A lone T takes the place of the whole E.
+                    push(children[1], SUM);
+                    push(children[0], is_empty(children[1]) ? top.required : SUM);
+                    break;
+                }
+                case T: {
+                    push(children[1], SUM);
+                    push(children[0], is_empty(children[1]) ? top.required : PRODUCT);
+                    break;
+                }
+                case X:
+                case Y: {
+                    if (is_empty(cur)) {
+                        break;
+                    }
+                    push(children[2], SUM);
+                    push(children[1], cur.type == X ? PRODUCT : UNARY);
+                    push(children[0], SUM, BINARY);
+                    break;
+                }
+                case F: {
+                    if (children.size() == 2) {
+                        push(children[1], UNARY);
+                        push(children[0], SUM);
+                    } else if (children.size() == 3) {
+                        bool keep = mode != RENDER_CANONICAL
+                                    || (top.required > SUM && binding_of(&children[1]) < top.required);
+                        push(children[2], SUM, keep ? PLAIN : HIDDEN);
+                        // Inside parentheses, or in their place when they are dropped,
+                        // the E binds tightly enough by now.
+                        push(children[1], SUM);
+                        push(children[0], SUM, keep ? PLAIN : HIDDEN);
+                    } else {
+                        push(children[0], SUM);
+                    }
+                    break;
+                }
+                default: {
+                    for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                        push(*it, SUM);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    struct length_sink {
+        size_t length = 0;
+
+        void operator()(std::string_view piece) {
+            length += piece.size();
+        }
+    };
+
+    struct buffer_sink {
+        char *out;
+
+        void operator()(std::string_view piece) {
+            std::memcpy(out, piece.data(), piece.size());
+            out += piece.size();
+        }
+    };
+
+    struct stream_sink {
+        static constexpr size_t CHUNK = 1 << 16;
+
+        std::ostream &out;
+        std::string buffer;
+
+        void operator()(std::string_view piece) {
+            if (buffer.size() + piece.size() > CHUNK) {
+                flush();
+            }
+            if (piece.size() > CHUNK) {
+                out.write(piece.data(), static_cast<std::streamsize>(piece.size()));
+            } else {
+                buffer.append(piece);
+            }
+        }
+
+        void flush() {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    };
+}
+
+size_t rendered_length(node const &tree, render_mode mode) {
+    length_sink sink;
+    walk(tree, mode, sink);
+    return sink.length;
+}
+
+char *render_to(node const &tree, char *out, render_mode mode) {
+    buffer_sink sink{out};
+    walk(tree, mode, sink);
+    return sink.out;
+}
+
+void render(node const &tree, std::string &out, render_mode mode) {
+    auto start = out.size();
+    out.resize(start + rendered_length(tree, mode));
+    render_to(tree, &out[0] + start, mode);
+}
+
+std::string render(node const &tree, render_mode mode) {
+    std::string res;
+    render(tree, res, mode);
+    return res;
+}
+
+void render(node const &tree, std::ostream &out, render_mode mode) {
+    stream_sink sink{out, {}};
+    sink.buffer.reserve(stream_sink::CHUNK);
+    walk(tree, mode, sink);
+    sink.flush();
+}
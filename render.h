@@ -0,0 +1,26 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "parser.h"
+
+enum render_mode {
+    // Token literals as they are, without whitespace; this is node::to_string().
+    RENDER_VERBATIM,
+    // A space on both sides of binary operators, none after unary ones or inside parentheses.
+    RENDER_NORMALIZED,
+    // RENDER_NORMALIZED without the parentheses that precedence and left associativity make
+    // redundant: the text parses back to the same operator tree (see parse_ast).
+    RENDER_CANONICAL
+};
+
+// Turns parse trees back into text without recursion. The string overloads make two
+// passes, one to compute the exact length and one to write into a buffer of that size;
+// the stream overload makes one pass through a fixed-size buffer.
+size_t rendered_length(node const& tree, render_mode mode = RENDER_VERBATIM);
+// Writes rendered_length(tree, mode) bytes to out and returns the end of them.
+char* render_to(node const& tree, char* out, render_mode mode = RENDER_VERBATIM);
+std::string render(node const& tree, render_mode mode = RENDER_VERBATIM);
+// Appends to out.
+void render(node const& tree, std::string& out, render_mode mode = RENDER_VERBATIM);
+void render(node const& tree, std::ostream& out, render_mode mode = RENDER_VERBATIM);
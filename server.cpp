@@ -0,0 +1,446 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+#include "batch.h"
+
+struct parse_server::connection {
+    int fd;
+    // Workers signal finished answers here.
+    int wake;
+    std::thread io;
+    bool finished = false;
+    // Set by stop(), which then signals wake.
+    std::atomic<bool> closing{false};
+
+    // Answers that wait for the I/O thread, by request number.
+    std::mutex lock;
+    std::map<size_t, std::string> done;
+
+    connection(int fd, int wake) : fd(fd), wake(wake) {}
+
+    ~connection() {
+        ::close(wake);
+        ::close(fd);
+    }
+};
+
+// Closes fd, if any, and throws the error of the failed call.
+[[noreturn]] static void socket_error(int fd, char const *what, std::string const &endpoint) {
+    int err = errno;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    throw std::system_error(err, std::generic_category(), what + (": " + endpoint));
+}
+
+static bool is_tcp(std::string const &endpoint) {
+    return endpoint.size() > 1 && endpoint[0] == ':'
+           && std::all_of(endpoint.begin() + 1, endpoint.end(), [](char c) {
+               return '0' <= c && c <= '9';
+           });
+}
+
+static sockaddr_in tcp_address(std::string const &endpoint) {
+    auto port = std::stoul(endpoint.substr(1));
+    if (port > UINT16_MAX) {
+        throw std::invalid_argument("Invalid port: " + endpoint);
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+static sockaddr_un unix_address(std::string const &endpoint) {
+    sockaddr_un addr{};
+    if (endpoint.empty() || endpoint.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("Invalid socket path: " + endpoint);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, endpoint.data(), endpoint.size());
+    return addr;
+}
+
+static void set_no_delay(int fd) {
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int listen_endpoint(std::string const &endpoint) {
+    int fd;
+    if (is_tcp(endpoint)) {
+        auto addr = tcp_address(endpoint);
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            socket_error(fd, "Can't create socket", endpoint);
+        }
+        int one = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            socket_error(fd, "Can't bind", endpoint);
+        }
+    } else {
+        auto addr = unix_address(endpoint);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            socket_error(fd, "Can't create socket", endpoint);
+        }
+        // A socket left behind by a previous server would make bind() fail.
+        struct stat info{};
+        if (::stat(endpoint.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+            ::unlink(endpoint.c_str());
+        }
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            socket_error(fd, "Can't bind", endpoint);
+        }
+    }
+    if (::listen(fd, SOMAXCONN) < 0) {
+        socket_error(fd, "Can't listen", endpoint);
+    }
+    return fd;
+}
+
+int connect_endpoint(std::string const &endpoint) {
+    int fd;
+    if (is_tcp(endpoint)) {
+        auto addr = tcp_address(endpoint);
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            socket_error(fd, "Can't connect", endpoint);
+        }
+        set_no_delay(fd);
+    } else {
+        auto addr = unix_address(endpoint);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            socket_error(fd, "Can't connect", endpoint);
+        }
+    }
+    return fd;
+}
+
+parse_server::parse_server(std::string const &endpoint, server_options const &options)
+        : options(options), listen_fd(listen_endpoint(endpoint)) {
+    if (!is_tcp(endpoint)) {
+        unix_path = endpoint;
+    }
+}
+
+parse_server::~parse_server() {
+    ::close(listen_fd);
+    if (!unix_path.empty()) {
+        ::unlink(unix_path.c_str());
+    }
+}
+
+uint16_t parse_server::port() const {
+    sockaddr_in addr{};
+    socklen_t length = sizeof(addr);
+    if (::getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &length) < 0 || addr.sin_family != AF_INET) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+void parse_server::run() {
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::max<size_t>(options.threads, 1); ++i) {
+        workers.emplace_back(&parse_server::work_loop, this);
+    }
+    int error = 0;
+    while (true) {
+        int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            int err = errno;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (stopping) {
+                    break;
+                }
+            }
+            if (err == EMFILE || err == ENFILE) {
+                // Out of descriptors: give the open connections time to finish.
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            } else if (err != EINTR && err != ECONNABORTED) {
+                error = err;
+                break;
+            }
+            continue;
+        }
+        int wake = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake < 0) {
+            // Out of descriptors as well; the client sees its connection closed.
+            ::close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        set_no_delay(fd);
+        auto conn = std::make_shared<connection>(fd, wake);
+        reap(false);
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping) {
+            break;
+        }
+        connections.push_back(conn);
+        conn->io = std::thread(&parse_server::io_loop, this, conn);
+    }
+    if (error) {
+        stop();
+    }
+    reap(true);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        drained = true;
+        changed.notify_all();
+    }
+    for (auto &item : workers) {
+        item.join();
+    }
+    if (error) {
+        throw std::system_error(error, std::generic_category(), "Can't accept a connection");
+    }
+}
+
+void parse_server::stop() {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    ::shutdown(listen_fd, SHUT_RDWR);
+    for (auto &conn : connections) {
+        ::shutdown(conn->fd, SHUT_RD);
+        conn->closing = true;
+        uint64_t one = 1;
+        while (::write(conn->wake, &one, sizeof(one)) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+// Joins the I/O threads of closed connections, or of all of them.
+void parse_server::reap(bool all) {
+    std::list<std::shared_ptr<connection>> dead;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = connections.begin(); it != connections.end();) {
+            auto next = std::next(it);
+            if (all || (*it)->finished) {
+                dead.splice(dead.end(), connections, it);
+            }
+            it = next;
+        }
+    }
+    for (auto &conn : dead) {
+        conn->io.join();
+    }
+}
+
+// Frames requests and writes answers for one connection. The socket is nonblocking, so
+// a client that doesn't read its answers stalls only its own thread: reading pauses
+// once max_in_flight requests are being parsed or waiting to be written.
+void parse_server::io_loop(std::shared_ptr<connection> conn) {
+    size_t submitted = 0;
+    // Answers taken from conn->done, and those of them sent (or dropped) in full.
+    size_t taken = 0;
+    size_t written = 0;
+    std::string in;
+    std::string out;
+    size_t out_pos = 0;
+    // Ends in out of the answers taken but not yet sent in full.
+    std::deque<size_t> answer_ends;
+    bool reading = true;
+    bool valid = true;
+    bool broken = false;
+    // Once the server stops, the time left to send what was read.
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    std::vector<char> chunk(1 << 16);
+
+    auto has_room = [&] {
+        return submitted - written < options.max_in_flight;
+    };
+    auto submit = [&](std::string text) {
+        std::lock_guard<std::mutex> guard(lock);
+        work.push_back({conn, submitted++, std::move(text)});
+        changed.notify_one();
+    };
+    // Submits the complete requests at the front of in while there is room for them.
+    auto frame = [&] {
+        size_t pos = 0;
+        while (has_room()) {
+            if (options.frames == FRAMING_LINES) {
+                auto end = in.find('\n', pos);
+                if (end == std::string::npos) {
+                    valid = in.size() - pos <= options.max_request;
+                    break;
+                }
+                auto length = end - pos - (end > pos && in[end - 1] == '\r');
+                submit(in.substr(pos, length));
+                pos = end + 1;
+            } else {
+                if (in.size() - pos < 4) {
+                    break;
+                }
+                auto const *header = reinterpret_cast<unsigned char const *>(in.data() + pos);
+                size_t length = size_t(header[0]) << 24 | size_t(header[1]) << 16 | size_t(header[2]) << 8 | header[3];
+                if (length > options.max_request) {
+                    valid = false;
+                    break;
+                }
+                if (in.size() - pos - 4 < length) {
+                    break;
+                }
+                submit(in.substr(pos + 4, length));
+                pos += 4 + length;
+            }
+        }
+        in.erase(0, pos);
+        reading = reading && valid;
+    };
+
+    while (true) {
+        if (conn->closing && !deadline) {
+            deadline = std::chrono::steady_clock::now() + options.stop_timeout;
+        }
+        if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+            // The client isn't taking its answers: drop them, as if it were gone.
+            broken = true;
+            reading = false;
+        }
+        {
+            std::lock_guard<std::mutex> guard(conn->lock);
+            for (auto it = conn->done.begin(); it != conn->done.end() && it->first == taken; it = conn->done.erase(it)) {
+                out.append(it->second);
+                answer_ends.push_back(out.size());
+                ++taken;
+            }
+        }
+        while (!broken && out_pos < out.size()) {
+            auto sent = ::send(conn->fd, out.data() + out_pos, out.size() - out_pos, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent < 0) {
+                // The client is gone: stop reading and drop the remaining answers.
+                broken = true;
+                reading = false;
+                break;
+            }
+            out_pos += static_cast<size_t>(sent);
+        }
+        if (broken) {
+            out_pos = out.size();
+        }
+        for (; !answer_ends.empty() && answer_ends.front() <= out_pos; answer_ends.pop_front()) {
+            ++written;
+        }
+        if (out_pos && out_pos >= out.size() / 2) {
+            out.erase(0, out_pos);
+            for (auto &end : answer_ends) {
+                end -= out_pos;
+            }
+            out_pos = 0;
+        }
+        if (reading) {
+            frame();
+        }
+        if (!reading && written == submitted) {
+            break;
+        }
+
+        short events = (reading && has_room() ? POLLIN : 0) | (out_pos < out.size() ? POLLOUT : 0);
+        pollfd fds[] = {{events ? conn->fd : -1, events, 0}, {conn->wake, POLLIN, 0}};
+        int timeout = -1;
+        if (deadline) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+            timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(left.count(), 0));
+        }
+        if (::poll(fds, 2, timeout) < 0) {
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            while (::read(conn->wake, &count, sizeof(count)) < 0 && errno == EINTR) {
+            }
+        }
+        if (!(events & POLLIN) || !(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+        auto got = ::read(conn->fd, chunk.data(), chunk.size());
+        if (got > 0) {
+            in.append(chunk.data(), static_cast<size_t>(got));
+            frame();
+        } else if (got == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            reading = false;
+            // Like getline(), a last line without a newline is still a request.
+            if (valid && options.frames == FRAMING_LINES && !in.empty()) {
+                if (in.back() == '\r') {
+                    in.pop_back();
+                }
+                submit(std::move(in));
+            }
+        }
+    }
+    ::shutdown(conn->fd, SHUT_WR);
+    std::lock_guard<std::mutex> guard(lock);
+    conn->finished = true;
+}
+
+void parse_server::work_loop() {
+    batch_worker state;
+    while (true) {
+        request item;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            changed.wait(guard, [this] {
+                return drained || !work.empty();
+            });
+            if (work.empty()) {
+                return;
+            }
+            item = std::move(work.front());
+            work.pop_front();
+        }
+        std::string response;
+        if (options.frames == FRAMING_LENGTH) {
+            response.assign(4, '\0');
+        }
+        state.process(item.text, item.seq + 1, options.ast, response);
+        if (options.frames == FRAMING_LENGTH) {
+            response.pop_back();
+            auto length = response.size() - 4;
+            for (size_t i = 0; i < 4; ++i) {
+                response[i] = static_cast<char>(length >> (24 - 8 * i) & 0xFF);
+            }
+        }
+        complete(*item.conn, item.seq, std::move(response));
+    }
+}
+
+// Queues the answer for the connection's I/O thread and wakes it up.
+void parse_server::complete(connection &conn, size_t seq, std::string response) {
+    {
+        std::lock_guard<std::mutex> guard(conn.lock);
+        conn.done.emplace(seq, std::move(response));
+    }
+    uint64_t one = 1;
+    while (::write(conn.wake, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
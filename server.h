@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum framing {
+    // One expression per line, one JSON object per line back.
+    FRAMING_LINES,
+    // A 4-byte big-endian length before every expression and every JSON object.
+    FRAMING_LENGTH
+};
+
+struct server_options {
+    size_t threads = 1;
+    bool ast = false;
+    framing frames = FRAMING_LINES;
+    // Requests of one connection being parsed or waiting to be written; reading from
+    // the connection pauses at this limit.
+    size_t max_in_flight = 1024;
+    // Longer requests close the connection.
+    size_t max_request = 1 << 24;
+    // After stop(), answers a client hasn't taken within this time are dropped.
+    std::chrono::milliseconds stop_timeout{1000};
+};
+
+// Opens a listening socket. ":PORT" is a TCP port on the loopback interface (0 picks
+// a free one), anything else is the path of a Unix domain socket.
+int listen_endpoint(std::string const &endpoint);
+int connect_endpoint(std::string const &endpoint);
+
+// Long-running parser. Every connection has an I/O thread that frames requests, queues
+// them for a fixed set of workers with reusable buffers and writes the answers from a
+// nonblocking socket, so workers never wait for a client. Requests are pipelined, so a
+// client may send many before reading, and answers come back in request order as the
+// objects of run_batch(), numbered per connection.
+class parse_server {
+    struct connection;
+    struct request {
+        std::shared_ptr<connection> conn;
+        size_t seq;
+        std::string text;
+    };
+
+    server_options options;
+    std::string unix_path;
+    int listen_fd = -1;
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<request> work;
+    std::list<std::shared_ptr<connection>> connections;
+    bool stopping = false;
+    // Every I/O thread is done; workers exit once the queue is empty.
+    bool drained = false;
+
+    void work_loop();
+    void io_loop(std::shared_ptr<connection> conn);
+    void complete(connection &conn, size_t seq, std::string response);
+    void reap(bool all);
+public:
+    parse_server(std::string const &endpoint, server_options const &options);
+    ~parse_server();
+
+    parse_server(parse_server const&) = delete;
+    parse_server& operator=(parse_server const&) = delete;
+
+    // The bound port of a TCP server, 0 for a Unix socket.
+    uint16_t port() const;
+
+    // Serves until stop(); requests already read are still answered, for at most
+    // stop_timeout to clients that don't read.
+    void run();
+    void stop();
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "lexer.h"
+#include "parser.h"
+#include "ll_driver.h"
+
+// Compile-time counterpart of tokenize/parse/evaluate for expression literals:
+//
+//     constexpr auto area = "2 * (3 + 4)"_expr;
+//     static_assert(area.value() == 14);
+//
+// The parse tree is laid out in fixed-size arrays inside the object, so a constexpr
+// static_tree costs nothing at startup and never allocates. It is built by ll_parse(),
+// the LL(1) driver parse() uses. Values are 64-bit; a lexer, grammar, size or overflow
+// error in a constant expression stops compilation at the call of the matching static_*
+// function below, and throws the usual exception when the tree is built at run time.
+
+[[noreturn]] inline void static_unexpected_symbol(std::string_view source, size_t offset) {
+    source_span where{offset, 1};
+    for (size_t i = 0; i < offset; ++i) {
+        where.column = source[i] == '\n' ? 1 : where.column + 1;
+        where.line += source[i] == '\n';
+    }
+    throw lexer_exception(source, where);
+}
+
+[[noreturn]] inline void static_unexpected_token(size_t index) {
+    throw parser_exception("Unexpected token at position " + std::to_string(index));
+}
+
+[[noreturn]] inline void static_too_large(size_t index) {
+    throw parser_exception("Expression too large for static_tree at position " + std::to_string(index));
+}
+
+[[noreturn]] inline void static_overflow(size_t offset) {
+    throw std::overflow_error("Value out of the 64-bit range at offset " + std::to_string(offset));
+}
+
+struct static_token {
+    token_type type = END;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+struct static_node {
+    node_type type = EPS;
+    uint32_t tok = UINT32_MAX;
+    uint32_t first = UINT32_MAX;
+    uint32_t next = UINT32_MAX;
+};
+
+// Parse tree of an N-byte literal (including the terminating zero) in preorder, with
+// first-child/next-sibling links like flat_tree.
+template <size_t N>
+class static_tree {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr size_t max_tokens = N;
+    static constexpr size_t max_nodes = 5 * max_tokens + 6;
+
+private:
+    std::array<char, N> src{};
+    size_t length = 0;
+    std::array<static_token, max_tokens> toks{};
+    size_t token_count = 0;
+    std::array<static_node, max_nodes> nodes{};
+    size_t node_count = 0;
+
+    static constexpr bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    constexpr void push_token(token_type type, size_t offset, size_t len) {
+        toks[token_count++] = {type, static_cast<uint32_t>(offset), static_cast<uint32_t>(len)};
+    }
+
+    constexpr void lex() {
+        size_t i = 0;
+        while (i < length) {
+            char c = src[i];
+            if (is_space(c)) {
+                ++i;
+                continue;
+            }
+            if ('0' <= c && c <= '9') {
+                size_t start = i;
+                while (i < length && '0' <= src[i] && src[i] <= '9') {
+                    ++i;
+                }
+                push_token(NUMBER, start, i - start);
+                continue;
+            }
+            switch (c) {
+                case '+': {
+                    push_token(PLUS, i, 1);
+                    break;
+                }
+                case '-': {
+                    push_token(MINUS, i, 1);
+                    break;
+                }
+                case '*': {
+                    push_token(MUL, i, 1);
+                    break;
+                }
+                case '(': {
+                    push_token(LEFT_PARENTHESIS, i, 1);
+                    break;
+                }
+                case ')': {
+                    push_token(RIGHT_PARENTHESIS, i, 1);
+                    break;
+                }
+                default: {
+                    static_unexpected_symbol(source(), i);
+                }
+            }
+            ++i;
+        }
+        push_token(END, length, 0);
+    }
+
+    // Fixed-capacity stack for ll_parse().
+    template <class T, size_t Capacity>
+    struct fixed_stack {
+        std::array<T, Capacity> items{};
+        size_t count = 0;
+        size_t const &ind;
+
+        constexpr bool empty() const {
+            return !count;
+        }
+
+        constexpr T back() const {
+            return items[count - 1];
+        }
+
+        constexpr void pop_back() {
+            --count;
+        }
+
+        constexpr void push_back(T const &item) {
+            if (count == Capacity) {
+                static_too_large(ind);
+            }
+            items[count++] = item;
+        }
+    };
+
+    struct token_source {
+        static_tree const &tree;
+
+        constexpr token_type type(size_t ind) const {
+            return tree.toks[ind].type;
+        }
+
+        constexpr void next(size_t &ind) const {
+            ++ind;
+        }
+    };
+
+    // flat_builder's linking into the node arrays.
+    struct builder {
+        static_tree &tree;
+        size_t const &ind;
+        std::array<uint32_t, max_nodes> parents{};
+        std::array<uint32_t, max_nodes> last{};
+        size_t open_count = 0;
+
+        constexpr uint32_t add(node_type type, uint32_t tok) {
+            if (tree.node_count == max_nodes) {
+                static_too_large(ind);
+            }
+            auto cur = static_cast<uint32_t>(tree.node_count++);
+            tree.nodes[cur] = {type, tok, NONE, NONE};
+            if (open_count) {
+                if (last[open_count - 1] != NONE) {
+                    tree.nodes[last[open_count - 1]].next = cur;
+                } else {
+                    tree.nodes[parents[open_count - 1]].first = cur;
+                }
+                last[open_count - 1] = cur;
+            }
+            return cur;
+        }
+
+        constexpr void open(node_type type, size_t) {
+            parents[open_count] = add(type, NONE);
+            last[open_count++] = NONE;
+        }
+
+        constexpr void close() {
+            --open_count;
+        }
+
+        constexpr void eps() {
+            add(EPS, NONE);
+        }
+
+        constexpr void term(token_source const &, size_t i) {
+            add(TERM, static_cast<uint32_t>(i));
+        }
+    };
+
+    constexpr void parse() {
+        using namespace grammar;
+        size_t ind = 0;
+        fixed_stack<symbol, 4 * max_nodes + 1> stack{{}, 0, ind};
+        stack.push_back({NONTERMINAL, static_cast<uint8_t>(start)});
+        builder out{*this, ind};
+        ll_parse(token_source{*this}, ind, stack, out, [](size_t i, symbol) {
+            static_unexpected_token(i);
+        });
+        if (toks[ind].type != END) {
+            static_unexpected_token(ind);
+        }
+    }
+
+    static constexpr int64_t checked(bool overflow, int64_t value, size_t offset) {
+        if (overflow) {
+            static_overflow(offset);
+        }
+        return value;
+    }
+
+    constexpr size_t offset_of(uint32_t i) const {
+        return toks[nodes[i].tok].offset;
+    }
+
+    constexpr int64_t number(uint32_t i) const {
+        int64_t res = 0;
+        for (char c : text(i)) {
+            int64_t next = 0;
+            bool overflow = __builtin_mul_overflow(res, 10, &next) || __builtin_add_overflow(next, c - '0', &next);
+            res = checked(overflow, next, offset_of(i));
+        }
+        return res;
+    }
+
+    // E -> T X and the X chain, folded left to right.
+    constexpr int64_t evaluate_e(uint32_t e) const {
+        auto t = nodes[e].first;
+        auto res = evaluate_t(t);
+        for (auto x = nodes[t].next; nodes[nodes[x].first].type != EPS;) {
+            auto op = nodes[x].first;
+            auto rhs = nodes[op].next;
+            auto value = evaluate_t(rhs);
+            int64_t next = 0;
+            bool overflow = term_type(op) == PLUS ? __builtin_add_overflow(res, value, &next)
+                                                   : __builtin_sub_overflow(res, value, &next);
+            res = checked(overflow, next, offset_of(op));
+            x = nodes[rhs].next;
+        }
+        return res;
+    }
+
+    // T -> F Y and the Y chain.
+    constexpr int64_t evaluate_t(uint32_t t) const {
+        auto f = nodes[t].first;
+        auto res = evaluate_f(f);
+        for (auto y = nodes[f].next; nodes[nodes[y].first].type != EPS;) {
+            auto op = nodes[y].first;
+            auto rhs = nodes[op].next;
+            auto value = evaluate_f(rhs);
+            int64_t next = 0;
+            bool overflow = __builtin_mul_overflow(res, value, &next);
+            res = checked(overflow, next, offset_of(op));
+            y = nodes[rhs].next;
+        }
+        return res;
+    }
+
+    // Unary chains are walked in a loop; only parentheses recurse.
+    constexpr int64_t evaluate_f(uint32_t f) const {
+        bool negate = false;
+        auto first = nodes[f].first;
+        while (term_type(first) == MINUS || term_type(first) == PLUS) {
+            negate ^= term_type(first) == MINUS;
+            f = nodes[first].next;
+            first = nodes[f].first;
+        }
+        auto res = term_type(first) == NUMBER ? number(first) : evaluate_e(nodes[first].next);
+        if (negate) {
+            int64_t next = 0;
+            bool overflow = __builtin_sub_overflow(int64_t(0), res, &next);
+            res = checked(overflow, next, offset_of(first));
+        }
+        return res;
+    }
+
+public:
+    constexpr explicit static_tree(char const (&s)[N]) {
+        while (length + 1 < N && s[length]) {
+            src[length] = s[length];
+            ++length;
+        }
+        lex();
+        parse();
+    }
+
+    constexpr std::string_view source() const {
+        return std::string_view(src.data(), length);
+    }
+
+    constexpr size_t size() const {
+        return node_count;
+    }
+
+    constexpr node_type type(uint32_t i) const {
+        return nodes[i].type;
+    }
+
+    constexpr uint32_t first_child(uint32_t i) const {
+        return nodes[i].first;
+    }
+
+    constexpr uint32_t next_sibling(uint32_t i) const {
+        return nodes[i].next;
+    }
+
+    constexpr token_type term_type(uint32_t i) const {
+        return toks[nodes[i].tok].type;
+    }
+
+    constexpr std::string_view text(uint32_t i) const {
+        return source().substr(toks[nodes[i].tok].offset, toks[nodes[i].tok].length);
+    }
+
+    constexpr int64_t value() const {
+        return evaluate_e(0);
+    }
+
+    node to_node() const {
+        node res(type(0));
+        std::vector<std::pair<uint32_t, node *>> stack{{0, &res}};
+        while (!stack.empty()) {
+            auto [i, cur] = stack.back();
+            stack.pop_back();
+            size_t count = 0;
+            for (auto c = first_child(i); c != NONE; c = next_sibling(c)) {
+                ++count;
+            }
+            cur->children.reserve(count);
+            for (auto c = first_child(i); c != NONE; c = next_sibling(c)) {
+                switch (type(c)) {
+                    case TERM: {
+                        cur->children.emplace_back(TERM, token(term_type(c), text(c)));
+                        break;
+                    }
+                    default: {
+                        auto &child = cur->children.emplace_back(type(c));
+                        if (type(c) != EPS) {
+                            stack.emplace_back(c, &child);
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+        return res;
+    }
+};
+
+template <size_t N>
+constexpr static_tree<N> parse_static(char const (&s)[N]) {
+    return static_tree<N>(s);
+}
+
+template <size_t N>
+constexpr int64_t evaluate_static(char const (&s)[N]) {
+    return static_tree<N>(s).value();
+}
+
+// String literal operator template, a GNU extension supported by GCC and Clang.
+template <class Char, Char... chars>
+constexpr static_tree<sizeof...(chars) + 1> operator""_expr() {
+    constexpr char s[] = {chars..., '\0'};
+    return static_tree<sizeof...(chars) + 1>(s);
+}
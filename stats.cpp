@@ -0,0 +1,199 @@
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include "stats.h"
+
+static thread_local stats_scope *innermost = nullptr;
+static thread_local uint64_t thread_allocations = 0;
+static thread_local uint64_t thread_allocated_bytes = 0;
+
+#ifdef PARSER_STATS
+
+// Every replaceable operator new, including the aligned ones std::pmr::new_delete_resource()
+// uses, counts here; all of them pair with std::free.
+static void *counted_alloc(size_t size, size_t alignment) noexcept {
+    ++thread_allocations;
+    thread_allocated_bytes += size;
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size ? size : 1);
+    }
+    auto rounded = (size ? size : 1) + alignment - 1;
+    return std::aligned_alloc(alignment, rounded - rounded % alignment);
+}
+
+void *operator new(size_t size) {
+    if (void *p = counted_alloc(size, alignof(std::max_align_t))) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    if (void *p = counted_alloc(size, static_cast<size_t>(alignment))) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void *operator new(size_t size, std::nothrow_t const &) noexcept {
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new[](size_t size, std::nothrow_t const &) noexcept {
+    return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new(size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept {
+    return counted_alloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::nothrow_t const &) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::nothrow_t const &) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t, std::nothrow_t const &) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, std::nothrow_t const &) noexcept {
+    std::free(p);
+}
+
+node_counter::~node_counter() {
+    if (auto *target = stats_scope::current()) {
+        for (size_t i = 0; i <= EPS; ++i) {
+            target->nodes[i] += nodes[i];
+        }
+        target->max_depth = std::max(target->max_depth, max_depth);
+    }
+}
+
+void count_tokens(token_buffer const &tokens) {
+    if (auto *target = stats_scope::current()) {
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            ++target->tokens[tokens.type(i)];
+        }
+    }
+}
+
+#endif
+
+stats_scope::stats_scope(parse_stats &out)
+        : out(out), outer(innermost), allocations(thread_allocations), allocated_bytes(thread_allocated_bytes) {
+    innermost = this;
+}
+
+stats_scope::~stats_scope() {
+    out.allocations += thread_allocations - allocations;
+    out.allocated_bytes += thread_allocated_bytes - allocated_bytes;
+    innermost = outer;
+}
+
+parse_stats *stats_scope::current() {
+    return innermost ? &innermost->out : nullptr;
+}
+
+static char const *const phase_names[] = {"read", "tokenize", "parse", "serialize"};
+
+static std::string type_name(token_type type) {
+    std::ostringstream os;
+    os << type;
+    return os.str();
+}
+
+void parse_stats::print(std::ostream &out) const {
+    uint64_t token_total = 0;
+    uint64_t node_total = 0;
+    for (auto x : tokens) {
+        token_total += x;
+    }
+    for (auto x : nodes) {
+        node_total += x;
+    }
+    out << "bytes read: " << bytes_read << '\n';
+    out << "tokens: " << token_total;
+    for (size_t i = 0; i <= END; ++i) {
+        out << (i ? ", " : " (") << type_name(static_cast<token_type>(i)) << ' ' << tokens[i];
+    }
+    out << ")\nnodes: " << node_total;
+    for (size_t i = 0; i <= EPS; ++i) {
+        out << (i ? ", " : " (") << to_string(static_cast<node_type>(i)) << ' ' << nodes[i];
+    }
+    out << ")\nmax depth: " << max_depth << '\n';
+    out << "allocations: " << allocations << " (" << allocated_bytes << " bytes)\n";
+    double total = 0;
+    out << "time:";
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        out << (i ? ", " : " ") << phase_names[i] << ' ' << seconds[i] * 1000 << " ms";
+        total += seconds[i];
+    }
+    out << ", total " << total * 1000 << " ms\n";
+}
+
+std::string parse_stats::to_json() const {
+    std::ostringstream os;
+    os << "{\"bytes_read\":" << bytes_read << ",\"tokens\":{";
+    for (size_t i = 0; i <= END; ++i) {
+        os << (i ? "," : "") << '"' << type_name(static_cast<token_type>(i)) << "\":" << tokens[i];
+    }
+    os << "},\"nodes\":{";
+    for (size_t i = 0; i <= EPS; ++i) {
+        os << (i ? "," : "") << '"' << to_string(static_cast<node_type>(i)) << "\":" << nodes[i];
+    }
+    os << "},\"max_depth\":" << max_depth << ",\"allocations\":" << allocations
+       << ",\"allocated_bytes\":" << allocated_bytes << ",\"seconds\":{";
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        os << (i ? "," : "") << '"' << phase_names[i] << "\":" << seconds[i];
+    }
+    os << "}}";
+    return os.str();
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include "lexer.h"
+#include "parser.h"
+
+enum stats_phase {
+    PHASE_READ, PHASE_TOKENIZE, PHASE_PARSE, PHASE_SERIALIZE, PHASE_COUNT
+};
+
+// Counters of one stats_scope. Allocations are counted only on the scope's thread.
+struct parse_stats {
+#ifdef PARSER_STATS
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    uint64_t bytes_read = 0;
+    uint64_t tokens[END + 1] = {};
+    uint64_t nodes[EPS + 1] = {};
+    uint64_t max_depth = 0;
+    uint64_t allocations = 0;
+    uint64_t allocated_bytes = 0;
+    double seconds[PHASE_COUNT] = {};
+
+    void print(std::ostream &out) const;
+    std::string to_json() const;
+};
+
+// Collects the statistics of everything the current thread parses while it is alive.
+// Scopes nest; the innermost one receives the counters. Other threads are not seen: the
+// chunks parse_parallel() hands to its pool, for one, are missing from the counts.
+class stats_scope {
+    parse_stats &out;
+    stats_scope *outer;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+
+public:
+    explicit stats_scope(parse_stats &out);
+    stats_scope(stats_scope const &) = delete;
+    stats_scope &operator=(stats_scope const &) = delete;
+    ~stats_scope();
+
+    static parse_stats *current();
+};
+
+#ifdef PARSER_STATS
+
+class phase_timer {
+    parse_stats *target;
+    stats_phase phase;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit phase_timer(stats_phase phase)
+            : target(stats_scope::current()), phase(phase), start(std::chrono::steady_clock::now()) {}
+
+    ~phase_timer() {
+        if (target) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            target->seconds[phase] += elapsed.count();
+        }
+    }
+};
+
+// Counts the nodes of one parse locally and adds them to the scope at the end.
+struct node_counter {
+    uint64_t nodes[EPS + 1] = {};
+    uint64_t max_depth = 0;
+
+    void add(node_type type, size_t depth = 0) {
+        ++nodes[type];
+        max_depth = std::max<uint64_t>(max_depth, depth);
+    }
+
+    ~node_counter();
+};
+
+void count_tokens(token_buffer const &tokens);
+
+#define PARSER_STATS_CONCAT_INNER(a, b) a##b
+#define PARSER_STATS_CONCAT(a, b) PARSER_STATS_CONCAT_INNER(a, b)
+#define PARSER_STATS_PHASE(phase) phase_timer PARSER_STATS_CONCAT(parser_stats_timer_, __LINE__)(phase)
+#define PARSER_STATS_ADD(field, value) \
+    do { \
+        if (auto *parser_stats_target = stats_scope::current()) { \
+            parser_stats_target->field += (value); \
+        } \
+    } while (false)
+#define PARSER_STATS_ONLY(...) __VA_ARGS__
+
+#else
+
+#define PARSER_STATS_PHASE(phase) ((void) 0)
+#define PARSER_STATS_ADD(field, value) ((void) 0)
+#define PARSER_STATS_ONLY(...)
+
+#endif
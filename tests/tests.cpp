@@ -1,13 +1,33 @@
 #include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
 #include <vector>
 #include <random>
 #include <string>
 #include <unordered_map>
 #include <gtest/gtest.h>
+#include <json.h>
 #include <gtest/gtest-death-test.h>
 #include <queue>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "../lexer.h"
 #include "../parser.h"
+#include "../ast.h"
+#include "../eval.h"
+#include "../batch.h"
+#include "../json_writer.h"
+#include "../binary_tree.h"
+#include "../mapped_file.h"
+#include "../dag.h"
+#include "../stats.h"
+#include "../static_expr.h"
+#include "../bytecode.h"
+#include "../server.h"
+#include "../render.h"
 
 using std::istringstream;
 using std::vector;
@@ -201,6 +221,12 @@ TEST(Lexing, BasicTest) {
     expected = {token(END)};
     EXPECT_EQ(tokenize(is), expected);
     EXPECT_EQ(tokenize(is.str()), expected);
+
+    reset_stream(is, "x_1*Rate + 0x14");
+    expected = {token(IDENTIFIER, "x_1"), token(MUL, "*"), token(IDENTIFIER, "Rate"), token(PLUS, "+"),
+                token(NUMBER, "0"), token(IDENTIFIER, "x14"), token(END)};
+    EXPECT_EQ(tokenize(is), expected);
+    EXPECT_EQ(tokenize(is.str()), expected);
 }
 
 TEST(Lexing, Failures) {
@@ -219,6 +245,10 @@ TEST(Lexing, Failures) {
     EXPECT_THROW(tokenize(is.str()), lexer_exception);
 
     reset_stream(is, "2424 + ------- 2 * 3 x ++ 8");
+    EXPECT_NO_THROW(tokenize(is));
+    EXPECT_NO_THROW(tokenize(is.str()));
+
+    reset_stream(is, "2424 + ------- 2 * 3 $ ++ 8");
     EXPECT_THROW(tokenize(is), lexer_exception);
     EXPECT_THROW(tokenize(is.str()), lexer_exception);
 
@@ -239,6 +269,133 @@ TEST(Lexing, RandomTokens) {
     }
 }
 
+TEST(Lexing, TokenBuffer) {
+    auto buffer = tokenize_buffer("  (12 +\n345)*6 ");
+    vector<token> expected = {token(LEFT_PARENTHESIS, "("), token(NUMBER, "12"), token(PLUS, "+"),
+                              token(NUMBER, "345"), token(RIGHT_PARENTHESIS, ")"), token(MUL, "*"),
+                              token(NUMBER, "6"), token(END)};
+    EXPECT_EQ(buffer.to_vector(), expected);
+    EXPECT_EQ(buffer.offset(1), 3u);
+    EXPECT_EQ(buffer.text(3), "345");
+    EXPECT_EQ(buffer.offset(7), buffer.source().size());
+
+    for (size_t len = 0; len < 200; ++len) {
+        expected = gen_random_tokens(len);
+        EXPECT_EQ(tokenize_buffer(to_string(expected)).to_vector(), expected);
+    }
+
+    string message;
+    try {
+        tokenize("1 + 3 / 4");
+    } catch (lexer_exception const& e) {
+        message = e.what();
+    }
+    EXPECT_EQ(message, "Unexpected symbol at position 7 (line 1, column 7):\n1 + 3 /\n      ^");
+}
+
+TEST(Lexing, Kernels) {
+    auto generator = std::ranlux24();
+    static constexpr char alphabet[] = "0123456789+-*() \t\n\r\v\fxZ_/$";
+    for (size_t len = 0; len < 300; ++len) {
+        string input;
+        for (size_t i = 0; i < len; ++i) {
+            auto range = (i % 7 == 0) ? sizeof(alphabet) - 1 : sizeof(alphabet) - 3;
+            input.push_back(alphabet[generator() % range]);
+        }
+        string expected_error;
+        vector<token> expected;
+        try {
+            expected = tokenize_buffer(input, KERNEL_SCALAR).to_vector();
+        } catch (lexer_exception const& e) {
+            expected_error = e.what();
+        }
+        for (auto kernel : {KERNEL_AUTO, KERNEL_SSE2, KERNEL_AVX2}) {
+            if (!kernel_supported(kernel)) {
+                continue;
+            }
+            string error;
+            vector<token> actual;
+            try {
+                actual = tokenize_buffer(input, kernel).to_vector();
+            } catch (lexer_exception const& e) {
+                error = e.what();
+            }
+            EXPECT_EQ(actual, expected);
+            EXPECT_EQ(error, expected_error);
+        }
+    }
+}
+
+
+TEST(Lexing, DecodedNumbers) {
+    auto generator = std::ranlux24();
+    for (size_t len = 1; len <= 60; ++len) {
+        string digits;
+        for (size_t i = 0; i < len; ++i) {
+            digits.push_back(static_cast<char>('0' + generator() % 10));
+        }
+        bigint expected(0);
+        for (char c : digits) {
+            expected = expected * bigint(10) + bigint(c - '0');
+        }
+        auto check = [&](token const& tok) {
+            if (len <= SHORT_DIGITS) {
+                EXPECT_TRUE(tok.limbs.empty());
+                EXPECT_EQ(bigint(false, {static_cast<uint32_t>(tok.value % bigint::BASE),
+                                         static_cast<uint32_t>(tok.value / bigint::BASE % bigint::BASE),
+                                         static_cast<uint32_t>(tok.value / bigint::BASE / bigint::BASE)}),
+                          expected) << digits;
+            } else {
+                EXPECT_EQ(tok.limbs.size(), limb_count(len));
+                EXPECT_EQ(bigint(false, {tok.limbs.begin(), tok.limbs.end()}), expected) << digits;
+            }
+        };
+        auto buffer = tokenize_buffer("(" + digits + ")");
+        check(buffer.at(1));
+        check(token(NUMBER, digits));
+        istringstream in(digits + " ");
+        token_stream stream(in, 7);
+        check(stream.current());
+        EXPECT_EQ(evaluate(parse_ast(tokenize_buffer("-" + digits))), -expected);
+    }
+    EXPECT_EQ(decode_eight_digits("09182736"), 9182736u);
+    EXPECT_EQ(decode_digits("1234567890123456789", 19), 1234567890123456789u);
+    EXPECT_EQ(token(NUMBER, "18446744073709551615").limbs.size(), 3u);
+}
+
+TEST(Lexing, InputBuffer) {
+    string source = "12 * (3 - 45)\n+ 123456789012345678901234";
+    auto expected = tokenize_buffer(source).to_vector();
+    auto path = ::testing::TempDir() + "parser_input.txt";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << source;
+    }
+    token_buffer tokens;
+    {
+        auto input = std::make_shared<input_buffer>(path);
+        EXPECT_TRUE(input->mapped());
+        EXPECT_EQ(input->view(), source);
+        tokens = tokenize_buffer(input->view(), input);
+    }
+    auto copy = tokens;
+    tokens.reset("7");
+    EXPECT_EQ(copy.to_vector(), expected);
+    EXPECT_EQ(copy.span(9).line, 2u);
+    EXPECT_EQ(evaluate(parse_ast(std::move(copy))), bigint("123456789012345678900730"));
+    std::remove(path.c_str());
+
+    int fds[2];
+    ASSERT_EQ(::pipe(fds), 0);
+    ASSERT_EQ(::write(fds[1], source.data(), source.size()), static_cast<ssize_t>(source.size()));
+    ::close(fds[1]);
+    input_buffer piped(fds[0], "pipe");
+    ::close(fds[0]);
+    EXPECT_FALSE(piped.mapped());
+    EXPECT_EQ(piped.view(), source);
+
+    EXPECT_THROW(input_buffer(::testing::TempDir() + "parser_missing.txt"), std::system_error);
+}
 
 TEST(Parsing, BasicTest) {
     istringstream is;
@@ -273,7 +430,9 @@ TEST(Parsing, Failures) {
     EXPECT_THROW(parse("1 + 2 / 1"), lexer_exception);
     EXPECT_THROW(parse("1 + 1 + 124 *"), parser_exception);
     EXPECT_THROW(parse("()"), parser_exception);
-    EXPECT_THROW(parse("5 + 0x14"), lexer_exception);
+    EXPECT_THROW(parse("5 + 0x14"), parser_exception);
+    EXPECT_THROW(parse("5 + $"), lexer_exception);
+    EXPECT_NO_THROW(parse("5 + x14 * (y - _z)"));
     EXPECT_NO_THROW(parse("5 + + 7"));
     EXPECT_THROW(parse("((5 + 3) * 2) + --------"), parser_exception);
     EXPECT_THROW(parse("(5 + 3) + (5 - 3) + * -7"), parser_exception);
@@ -282,6 +441,530 @@ TEST(Parsing, Failures) {
     EXPECT_THROW(parse("(5 + 7)) *    3"), parser_exception);
 }
 
+TEST(Parsing, Stream) {
+    for (int depth = 1; depth < 30; ++depth) {
+        auto expected = gen_random_tree(depth);
+        istringstream is(expected.to_string());
+        token_stream tokens(is, 7);
+        EXPECT_EQ(parse(tokens), expected);
+    }
+
+    for (auto s : {"1 + 1 + 124 *", "()", "(((( 5 + 66)", "(5 + 7)) *    3"}) {
+        istringstream is(s);
+        token_stream tokens(is, 3);
+        EXPECT_THROW(parse(tokens), parser_exception);
+    }
+
+    string message;
+    try {
+        istringstream is("12345 + 3 / 4");
+        token_stream tokens(is, 4);
+        parse(tokens);
+    } catch (lexer_exception const& e) {
+        message = e.what();
+    }
+    EXPECT_EQ(message, "Unexpected symbol at position 11 (line 1, column 11):\n12345 + 3 /\n          ^");
+}
+
+TEST(Parsing, Spans) {
+    auto tree = parse("1 +\n (23*4)");
+    EXPECT_EQ(tree.span.offset, 0u);
+    EXPECT_EQ(tree.span.length, 11u);
+    auto const &x = tree.children[1];
+    EXPECT_EQ(x.span.offset, 2u);
+    auto const &number = x.children[1].children[0].children[1].children[0].children[0].children[0];
+    EXPECT_EQ(*number.data, token(NUMBER, "23"));
+    EXPECT_EQ(number.span.offset, 6u);
+    EXPECT_EQ(number.span.line, 2u);
+    EXPECT_EQ(number.span.column, 3u);
+    EXPECT_EQ(x.children[2].span.offset, 11u);
+    EXPECT_EQ(x.children[2].span.length, 0u);
+
+    string long_line(200, '1');
+    long_line = long_line + " + 2 " + long_line + " 3";
+    for (auto input : {"1 +\n  2 * (3 +\n) - 4", "1 + 2 *\n\n  3 - *", "(1 +\n\t2", long_line.c_str()}) {
+        string buffered, streamed;
+        try {
+            parse(input);
+        } catch (std::exception const& e) {
+            buffered = e.what();
+        }
+        try {
+            istringstream is(input);
+            token_stream tokens(is, 5);
+            parse(tokens);
+        } catch (std::exception const& e) {
+            streamed = e.what();
+        }
+        EXPECT_FALSE(buffered.empty());
+        EXPECT_EQ(streamed, buffered);
+        EXPECT_LT(buffered.size(), 8 * DIAGNOSTIC_WINDOW);
+    }
+    string message;
+    try {
+        parse("1 +\n  2 * (3 +\n) - 4");
+    } catch (parser_exception const& e) {
+        message = e.what();
+    }
+    EXPECT_EQ(message, "Unexpected token RIGHT_PARENTHESIS at position 7 (line 3, column 1):\n)\n^\n"
+                       "Expected: IDENTIFIER LEFT_PARENTHESIS MINUS NUMBER PLUS ");
+}
+
+static void expect_same_spans(node const &a, node const &b) {
+    std::vector<std::pair<node const *, node const *>> stack{{&a, &b}};
+    while (!stack.empty()) {
+        auto [x, y] = stack.back();
+        stack.pop_back();
+        ASSERT_EQ(x->span.offset, y->span.offset);
+        ASSERT_EQ(x->span.length, y->span.length);
+        ASSERT_EQ(x->span.line, y->span.line);
+        ASSERT_EQ(x->span.column, y->span.column);
+        ASSERT_EQ(x->children.size(), y->children.size());
+        for (size_t i = 0; i < x->children.size(); ++i) {
+            stack.emplace_back(&x->children[i], &y->children[i]);
+        }
+    }
+}
+
+TEST(Parsing, Reparse) {
+    editable_tree doc("1 + 2 * (3 -\n 4)");
+    doc.apply({9, 1, "30 * 5"});
+    EXPECT_EQ(doc.source(), "1 + 2 * (30 * 5 -\n 4)");
+    EXPECT_EQ(doc.tree(), parse(doc.source()));
+    expect_same_spans(doc.tree(), parse(doc.source()));
+    EXPECT_THROW(doc.apply({0, 1, "("}), parser_exception);
+    EXPECT_EQ(doc.source(), "1 + 2 * (30 * 5 -\n 4)");
+    EXPECT_EQ(doc.tree(), parse("1 + 2 * (30 * 5 -\n 4)"));
+    EXPECT_THROW(doc.apply({doc.size(), 1, ""}), std::out_of_range);
+
+    auto generator = std::ranlux24();
+    static constexpr char alphabet[] = "0123456789+-*() \n";
+    for (int depth = 1; depth < 25; ++depth) {
+        string source = gen_random_tree(depth).to_string();
+        editable_tree edited_doc(source);
+        for (int step = 0; step < 30; ++step) {
+            text_edit edit{generator() % (source.size() + 1), 0, ""};
+            edit.removed = std::min<size_t>(generator() % 3, source.size() - edit.offset);
+            for (size_t i = generator() % 3; i > 0; --i) {
+                edit.inserted.push_back(alphabet[generator() % (sizeof(alphabet) - 1)]);
+            }
+            auto edited = source;
+            edited.replace(edit.offset, edit.removed, edit.inserted);
+            bool valid = true;
+            node expected(EPS);
+            try {
+                expected = parse(edited);
+            } catch (std::exception const &) {
+                valid = false;
+            }
+            if (!valid) {
+                EXPECT_ANY_THROW(edited_doc.apply(edit));
+                continue;
+            }
+            edited_doc.apply(edit);
+            source = edited;
+            ASSERT_EQ(edited_doc.source(), edited);
+            // Settling every few edits leaves shifts pending across several of them.
+            if (step % 4 == 3) {
+                ASSERT_EQ(edited_doc.tree(), expected);
+                expect_same_spans(edited_doc.tree(), expected);
+            }
+        }
+        ASSERT_EQ(edited_doc.tree(), parse(source));
+        expect_same_spans(edited_doc.tree(), parse(source));
+    }
+}
+
+TEST(Parsing, FlatTree) {
+    for (int depth = 1; depth < 40; ++depth) {
+        auto expected = gen_random_tree(depth);
+        auto source = expected.to_string();
+        auto tree = parse_flat(tokenize_buffer(source));
+        EXPECT_EQ(tree.to_node(), expected);
+        EXPECT_EQ(tree.to_string(), source);
+        EXPECT_EQ(tree.to_json(), expected.to_json());
+        EXPECT_EQ(tree, parse_flat(tokenize_buffer(source)));
+    }
+    EXPECT_EQ(parse_flat(tokenize_buffer("1+2")).to_json(-1),
+              R"({"E":[{"T":[{"F":["1"]},{"Y":["EPS"]}]},{"X":["+",{"T":[{"F":["2"]},{"Y":["EPS"]}]},{"X":["EPS"]}]}]})");
+    EXPECT_NE(parse_flat(tokenize_buffer("1+2")), parse_flat(tokenize_buffer("1-2")));
+    EXPECT_THROW(parse_flat(tokenize_buffer("(5 + 7)) *    3")), parser_exception);
+}
+
+TEST(Parsing, Render) {
+    auto ast_of = [](string const& source) {
+        return parse_ast(tokenize_buffer(source)).to_json();
+    };
+    for (int depth = 1; depth < 30; ++depth) {
+        auto tree = gen_random_tree(depth);
+        string verbatim;
+        for (auto const& item : parse_flat(tokenize_buffer(tree.to_string())).tokens().to_vector()) {
+            verbatim.append(item.data);
+        }
+        EXPECT_EQ(render(tree), verbatim);
+        for (auto mode : {RENDER_VERBATIM, RENDER_NORMALIZED, RENDER_CANONICAL}) {
+            auto text = render(tree, mode);
+            EXPECT_EQ(rendered_length(tree, mode), text.size());
+            std::ostringstream out;
+            render(tree, out, mode);
+            EXPECT_EQ(out.str(), text);
+            EXPECT_EQ(ast_of(text), ast_of(verbatim)) << text;
+        }
+        EXPECT_EQ(parse(render(tree, RENDER_NORMALIZED)), tree);
+        auto canonical = render(tree, RENDER_CANONICAL);
+        EXPECT_EQ(render(parse(canonical), RENDER_CANONICAL), canonical);
+    }
+
+    auto tree = parse("((1+2))*(3*(4))-(5-(6+x))+-(8*9)+((-(y)))-(2*3)*((4))");
+    EXPECT_EQ(render(tree, RENDER_NORMALIZED), "((1 + 2)) * (3 * (4)) - (5 - (6 + x)) + -(8 * 9) + ((-(y))) - (2 * 3) * ((4))");
+    EXPECT_EQ(render(tree, RENDER_CANONICAL), "(1 + 2) * (3 * 4) - (5 - (6 + x)) + -(8 * 9) + -y - 2 * 3 * 4");
+    string prefix = "20 + ";
+    render(parse("1 + 2"), prefix, RENDER_CANONICAL);
+    EXPECT_EQ(prefix, "20 + 1 + 2");
+
+    string parens = string(100000, '(') + "1 + 2" + string(100000, ')') + " * 3";
+    EXPECT_EQ(render(parse(parens), RENDER_CANONICAL), "(1 + 2) * 3");
+}
+
+TEST(Parsing, Deep) {
+    string sum = "1";
+    for (int i = 0; i < 200000; ++i) {
+        sum.append("+1");
+    }
+    auto tree = parse(sum);
+    EXPECT_EQ(tree.to_string(), sum);
+    EXPECT_EQ(tree, parse(sum));
+
+    string unary(200000, '-');
+    unary.push_back('1');
+    EXPECT_EQ(parse(unary).to_string(), unary);
+
+    string parens = string(100000, '(') + "1" + string(100000, ')');
+    EXPECT_EQ(parse_flat(tokenize_buffer(parens)).to_string(), parens);
+
+    parse_limits limits;
+    limits.max_depth = 1000;
+    EXPECT_THROW(parse(unary, limits), parser_exception);
+    EXPECT_NO_THROW(parse("-----1", limits));
+    limits = parse_limits();
+    limits.max_nodes = 100;
+    EXPECT_THROW(parse(sum, limits), parser_exception);
+    EXPECT_NO_THROW(parse("1+2+3", limits));
+}
+
+TEST(Parsing, Ast) {
+    EXPECT_EQ(parse_ast(tokenize_buffer("1 - 2 - 3")).to_json(),
+              R"({"Sub":[{"Sub":[{"Num":"1"},{"Num":"2"}]},{"Num":"3"}]})");
+    EXPECT_EQ(parse_ast(tokenize_buffer("-(1 + 2) * +3 * 4")).to_json(),
+              R"({"Mul":[{"Mul":[{"Neg":[{"Add":[{"Num":"1"},{"Num":"2"}]}]},{"Pos":[{"Num":"3"}]}]},{"Num":"4"}]})");
+    EXPECT_EQ(parse_ast(tokenize_buffer("((7))")).to_json(2), "{\n  \"Num\": \"7\"\n}");
+    EXPECT_EQ(parse_ast(tokenize_buffer("2*3")).to_json(2),
+              "{\n  \"Mul\": [\n    {\n      \"Num\": \"2\"\n    },\n    {\n      \"Num\": \"3\"\n    }\n  ]\n}");
+
+    auto tree = parse_ast(tokenize_buffer("1+2+3"));
+    EXPECT_EQ(tree.size(), 5u);
+    EXPECT_EQ(tree[tree.root()].type, ast_type::Add);
+
+    EXPECT_THROW(parse_ast(tokenize_buffer("1 + 1 + 124 *")), parser_exception);
+    EXPECT_THROW(parse_ast(tokenize_buffer("(5 + 7)) *    3")), parser_exception);
+}
+
+TEST(Parsing, Parallel) {
+    for (int depth = 1; depth < 30; ++depth) {
+        auto expected = gen_random_tree(depth);
+        auto tokens = tokenize_buffer(expected.to_string());
+        EXPECT_EQ(parse_parallel(tokens, 1 + depth % 4), expected);
+        EXPECT_EQ(parse_parallel(tokens.to_vector(), 3), expected);
+    }
+    string sum = "1";
+    for (int i = 0; i < 5000; ++i) {
+        sum.append(i % 2 ? "+-(2*3-4)" : "*5-6");
+    }
+    EXPECT_EQ(parse_parallel(tokenize_buffer(sum), 4), parse(sum));
+    expect_same_spans(parse_parallel(tokenize_buffer(sum + "\n"), 4), parse(sum + "\n"));
+
+    string names = "a";
+    for (int i = 0; i < 5000; ++i) {
+        names.append(i % 3 ? "+b" + std::to_string(i) : "-c*-d");
+    }
+    EXPECT_EQ(parse_parallel(tokenize_buffer(names), 4), parse(names));
+    expect_same_spans(parse_parallel(tokenize_buffer(names + "\n"), 4), parse(names + "\n"));
+
+    for (auto s : {"1 + 1 + 124 *", "()", "(((( 5 + 66)", "(5 + 7)) *    3", "1 + (2 - ) + 3", "1 2 + 3", ""}) {
+        string expected, actual;
+        try {
+            parse(s);
+        } catch (parser_exception const& e) {
+            expected = e.what();
+        }
+        try {
+            parse_parallel(tokenize_buffer(s), 3);
+        } catch (parser_exception const& e) {
+            actual = e.what();
+        }
+        EXPECT_FALSE(expected.empty());
+        EXPECT_EQ(actual, expected);
+    }
+
+    // One pool for every call, and the limits of the sequential parser.
+    thread_pool pool(3);
+    auto tokens = tokenize_buffer(names);
+    auto tree = parse(names);
+    auto before = pool.tasks_run();
+    EXPECT_EQ(parse_parallel(tokens, pool), tree);
+    EXPECT_GT(pool.tasks_run(), before);
+    EXPECT_EQ(parse_parallel(tokens.to_vector(), pool, {5010, 70000}), tree);
+    for (parse_limits limits : {parse_limits{5000, SIZE_MAX}, parse_limits{SIZE_MAX, 30000},
+                                parse_limits{6000, 2000}, parse_limits{3, SIZE_MAX}}) {
+        string expected, actual;
+        try {
+            parse(tokens, std::pmr::get_default_resource(), limits);
+        } catch (parser_exception const& e) {
+            expected = e.what();
+        }
+        try {
+            parse_parallel(tokens, pool, limits);
+        } catch (parser_exception const& e) {
+            actual = e.what();
+        }
+        EXPECT_FALSE(expected.empty());
+        EXPECT_EQ(actual, expected);
+    }
+}
+
+static nlohmann::json reference_json(node const &cur) {
+    switch (cur.type) {
+        case EPS: {
+            return to_string(EPS);
+        }
+        case TERM: {
+            return std::string(cur.data->data);
+        }
+        default: {
+            nlohmann::json tmp;
+            for (auto &&item : cur.children) {
+                tmp.push_back(reference_json(item));
+            }
+            return { {to_string(cur.type), tmp} };
+        }
+    }
+}
+
+TEST(Parsing, JsonWriter) {
+    for (int depth = 1; depth <= 8; ++depth) {
+        auto tree = gen_random_tree(depth);
+        auto reference = reference_json(tree);
+        EXPECT_EQ(tree.to_json(), reference.dump(2));
+        EXPECT_EQ(tree.to_json(-1), reference.dump());
+        EXPECT_EQ(tree.to_json(4), reference.dump(4));
+        std::ostringstream out;
+        tree.to_json(out);
+        EXPECT_EQ(out.str(), reference.dump(2));
+    }
+    EXPECT_EQ(n(E).to_json(), reference_json(n(E)).dump(2));
+    string escaped;
+    append_json_string(escaped, "a\"b\\\n\x01");
+    EXPECT_EQ(escaped, nlohmann::json("a\"b\\\n\x01").dump());
+}
+
+TEST(Parsing, BinaryTree) {
+    for (int depth = 1; depth <= 8; ++depth) {
+        auto tree = gen_random_tree(depth);
+        std::ostringstream out;
+        write_binary(tree, out);
+        auto bytes = out.str();
+        std::vector<uint64_t> aligned(bytes.size() / 8 + 1);
+        std::memcpy(aligned.data(), bytes.data(), bytes.size());
+        binary_tree_view view(reinterpret_cast<char const *>(aligned.data()), bytes.size());
+        EXPECT_EQ(view.to_node(), tree);
+        EXPECT_EQ(view.type(0), tree.type);
+        EXPECT_EQ(view.child_count(0), tree.children.size());
+        EXPECT_THROW(binary_tree_view(reinterpret_cast<char const *>(aligned.data()), bytes.size() - 1),
+                     binary_tree_exception);
+    }
+
+    auto tree = parse(tokenize("12 * (3 - 45)"));
+    auto path = ::testing::TempDir() + "parser_binary_tree.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        write_binary(tree, out);
+    }
+    mapped_file file(path);
+    binary_tree_view view(file.data(), file.size());
+    EXPECT_EQ(view.to_node(), tree);
+    std::remove(path.c_str());
+
+    string garbage(64, 'x');
+    EXPECT_THROW(binary_tree_view(garbage.data(), garbage.size()), binary_tree_exception);
+}
+
+TEST(Parsing, Dag) {
+    node_dag dag;
+    auto a = parse_dag(tokenize_buffer("(1 + 2 * 3) * (1 + 2 * 3)"), dag);
+    auto b = parse_dag(tokenize_buffer("(1+2*3)*(1+2*3)"), dag);
+    auto c = parse_dag(tokenize_buffer("(1 + 2 * 3) * (1 + 2 * 4)"), dag);
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_EQ(dag.to_node(a), parse("(1 + 2 * 3) * (1 + 2 * 3)"));
+    EXPECT_EQ(dag.tree_size(a), parse_flat(tokenize_buffer("(1+2*3)*(1+2*3)")).size());
+    auto left = dag.child(dag.child(dag.child(a, 0), 0), 1);
+    auto right = dag.child(dag.child(dag.child(dag.child(a, 0), 1), 1), 1);
+    EXPECT_EQ(left, right);
+
+    string sum = "1";
+    for (int i = 0; i < 1000; ++i) {
+        sum.append(" + (4 * 5 - 6)");
+    }
+    node_dag repeated;
+    auto root = parse_dag(tokenize_buffer(sum), repeated);
+    EXPECT_LT(repeated.size(), 4100u);
+    EXPECT_GT(repeated.tree_size(root), 25000u);
+    EXPECT_EQ(repeated.to_node(root), parse(sum));
+
+    for (int depth = 1; depth < 20; ++depth) {
+        auto tree = gen_random_tree(depth);
+        node_dag fresh;
+        auto id = fresh.intern(tree);
+        EXPECT_EQ(fresh.to_node(id), tree);
+        EXPECT_EQ(fresh.intern(tree), id);
+        EXPECT_EQ(parse_dag(tokenize_buffer(tree.to_string()), fresh), id);
+        node_dag other;
+        EXPECT_EQ(other.hash(other.intern(tree)), fresh.hash(id));
+    }
+}
+
+TEST(Parsing, Stats) {
+    if (!parse_stats::enabled) {
+        GTEST_SKIP();
+    }
+    string expr = "(1 + 2) * -3";
+    auto tokens = tokenize_buffer(expr);
+    auto flat = parse_flat(tokens);
+    parse_stats stats;
+    {
+        stats_scope scope(stats);
+        parse(expr).to_json(-1);
+        parse_stats inner;
+        {
+            stats_scope nested(inner);
+            parse(expr);
+        }
+        EXPECT_EQ(inner.nodes[TERM], stats.nodes[TERM]);
+    }
+    EXPECT_EQ(stats.bytes_read, expr.size());
+    EXPECT_EQ(stats.tokens[NUMBER], 3u);
+    EXPECT_EQ(stats.tokens[MINUS], 1u);
+    EXPECT_EQ(stats.tokens[LEFT_PARENTHESIS], 1u);
+    uint64_t nodes = 0;
+    for (auto x : stats.nodes) {
+        nodes += x;
+    }
+    EXPECT_EQ(nodes, flat.size());
+    EXPECT_EQ(stats.nodes[TERM], tokens.size() - 1);
+    EXPECT_GT(stats.max_depth, 3u);
+    EXPECT_GT(stats.allocations, 0u);
+    EXPECT_GT(stats.seconds[PHASE_PARSE], 0);
+    EXPECT_EQ(stats.to_json().front(), '{');
+
+    parse_stats active;
+    {
+        stats_scope scope(active);
+        EXPECT_EQ(stats_scope::current(), &active);
+        parse(expr);
+    }
+    EXPECT_EQ(stats_scope::current(), nullptr);
+    EXPECT_GT(active.allocations, 0u);
+    EXPECT_GT(active.allocated_bytes, 0u);
+    EXPECT_EQ(active.tokens[NUMBER], 3u);
+    EXPECT_EQ(active.nodes[TERM], tokens.size() - 1);
+}
+
+TEST(Parsing, StatsAllocations) {
+    if (!parse_stats::enabled) {
+        GTEST_SKIP();
+    }
+    string sum = "1";
+    for (int i = 0; i < 1000; ++i) {
+        sum.append("+1");
+    }
+    parse_stats stats;
+    {
+        stats_scope scope(stats);
+        parse(sum);
+    }
+    // Every inner node owns a children vector from the default memory resource.
+    uint64_t inner = 0;
+    for (size_t i = 0; i < TERM; ++i) {
+        inner += stats.nodes[i];
+    }
+    EXPECT_GT(inner, 4000u);
+    EXPECT_GE(stats.allocations, inner);
+    EXPECT_GE(stats.allocated_bytes, inner * sizeof(node));
+}
+
+TEST(Parsing, MemoryResource) {
+    string expr = "(1 + 23) * -45678901234567890123";
+    std::pmr::monotonic_buffer_resource arena;
+    auto tree = parse(expr, &arena);
+    EXPECT_EQ(tree, parse(expr));
+    EXPECT_EQ(tree.get_allocator().resource(), &arena);
+    EXPECT_EQ(tree.children[0].children[0].get_allocator().resource(), &arena);
+
+    auto tokens = tokenize(expr, &arena);
+    EXPECT_EQ(tokens.get_allocator().resource(), &arena);
+    EXPECT_EQ(tokens.back().get_allocator().resource(), &arena);
+    EXPECT_EQ(parse(tokens, &arena), tree);
+    EXPECT_THROW(parse(tokenize("1 +", &arena), &arena), parser_exception);
+
+    // Nothing may fall back to the default resource while the tree is built.
+    auto buffer = tokenize_buffer(expr);
+    auto *previous = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    EXPECT_NO_THROW(parse(buffer, &arena));
+    std::pmr::set_default_resource(previous);
+
+    node copy(tree);
+    EXPECT_EQ(copy.get_allocator().resource(), std::pmr::get_default_resource());
+    std::pmr::monotonic_buffer_resource other;
+    node moved(std::move(copy), &other);
+    EXPECT_EQ(moved, tree);
+    EXPECT_EQ(moved.children[0].get_allocator().resource(), &other);
+}
+
+TEST(Parsing, StaticExpr) {
+    constexpr auto formula = "2 * (3 + 4) - -5 * 2"_expr;
+    static_assert(formula.value() == 24);
+    static_assert(evaluate_static("1 - 2 - 3") == -4);
+    static_assert(evaluate_static("-(2 * -3) * +4") == 24);
+    static_assert(evaluate_static("9223372036854775807") == INT64_MAX);
+    EXPECT_EQ(formula.to_node(), parse("2 * (3 + 4) - -5 * 2"));
+    EXPECT_EQ(formula.size(), parse_flat(tokenize_buffer("2 * (3 + 4) - -5 * 2")).size());
+
+    constexpr auto nested = parse_static("((1))");
+    static_assert(nested.type(0) == E && nested.text(nested.first_child(nested.first_child(nested.first_child(0)))) == "(");
+    EXPECT_EQ(nested.to_node(), parse("((1))"));
+
+    for (int depth = 1; depth < 30; ++depth) {
+        auto tree = gen_random_tree(depth);
+        char buffer[4096] = {};
+        auto text = tree.to_string();
+        if (text.size() >= sizeof(buffer)) {
+            continue;
+        }
+        text.copy(buffer, text.size());
+        EXPECT_EQ(static_tree<sizeof(buffer)>(buffer).to_node(), tree);
+    }
+
+    char runtime[] = "2 * (3 + 4) - -5 * 2";
+    EXPECT_EQ(evaluate_static(runtime), formula.value());
+
+    char bad_symbol[] = "1 + x";
+    char bad_token[] = "(1 + 2";
+    char too_large[] = "99999999999 * 99999999999";
+    EXPECT_THROW(parse_static(bad_symbol), lexer_exception);
+    EXPECT_THROW(parse_static(bad_token), parser_exception);
+    EXPECT_THROW(evaluate_static(too_large), std::overflow_error);
+}
+
 TEST(Parsing, RandomExpressions) {
     for (int depth = 1; depth < 60; ++depth) {
         auto expected = gen_random_tree(depth);
@@ -289,7 +972,340 @@ TEST(Parsing, RandomExpressions) {
     }
 }
 
+TEST(Evaluation, BasicTest) {
+    EXPECT_EQ(evaluate(parse("1 - 2 - 3")), bigint(-4));
+    EXPECT_EQ(evaluate(parse("-(2 + 3) * 4 - -6 * +2")), bigint(-8));
+    EXPECT_EQ(evaluate(parse("3451093456103456014356 + --------2")).to_string(), "3451093456103456014358");
+    EXPECT_EQ(evaluate(parse("9223372036854775807 + 1")).to_string(), "9223372036854775808");
+    EXPECT_EQ(evaluate(parse("-9223372036854775807 - 1")), bigint(INT64_MIN));
+    EXPECT_EQ(evaluate(parse("4294967296 * 4294967296 * 4294967296 - 4294967296 * 4294967296 * 4294967296")),
+              bigint(0));
+    EXPECT_EQ(evaluate(parse_ast(tokenize_buffer("1 - 2 - 3"))), bigint(-4));
+
+    string sum = "0";
+    for (int i = 0; i < 100000; ++i) {
+        sum.append("-1");
+    }
+    EXPECT_EQ(evaluate(parse(sum)), bigint(-100000));
+}
+
+TEST(Evaluation, BigNumbers) {
+    for (size_t n : {10u, 300u, 5000u}) {
+        string nines(n, '9');
+        auto square = string(n - 1, '9') + "8" + string(n - 1, '0') + "1";
+        EXPECT_EQ(evaluate(parse(nines + "*" + nines)).to_string(), square);
+        EXPECT_EQ(evaluate(parse("-" + nines + "*" + nines)).to_string(), "-" + square);
+    }
+
+    auto generator = std::ranlux24();
+    auto random_number = [&generator](size_t digits) {
+        string res = std::to_string(1 + generator() % 9);
+        while (res.size() < digits) {
+            res.push_back(static_cast<char>('0' + generator() % 10));
+        }
+        return res;
+    };
+    for (size_t n : {50u, 700u, 3000u}) {
+        auto a = random_number(n);
+        auto b = random_number(n / 3 + 1);
+        auto lhs = evaluate(parse("(" + a + "+" + b + ")*(" + a + "+" + b + ")"));
+        auto rhs = evaluate(parse(a + "*" + a + "+2*" + a + "*" + b + "+" + b + "*" + b));
+        EXPECT_EQ(lhs, rhs);
+        EXPECT_EQ(evaluate(parse(a + "*" + b + "-" + b + "*" + a)), bigint(0));
+    }
+}
+
+TEST(Evaluation, RandomExpressions) {
+    for (int depth = 1; depth < 40; ++depth) {
+        auto tree = gen_random_tree(depth);
+        EXPECT_EQ(evaluate(tree), evaluate(parse_ast(tokenize_buffer(tree.to_string()))));
+    }
+}
+
+TEST(Evaluation, Parallel) {
+    thread_pool pool(3);
+    for (int depth = 1; depth < 40; ++depth) {
+        auto tree = gen_random_tree(depth);
+        EXPECT_EQ(evaluate_parallel(tree, pool, 8), evaluate(tree));
+    }
+
+    string sum = "1";
+    for (int i = 0; i < 20000; ++i) {
+        sum.append(i % 3 ? "+(2*-3*4)" : "-5*(6-7)");
+    }
+    auto tree = parse(sum);
+    EXPECT_EQ(evaluate_parallel(tree, pool, 16), evaluate(tree));
+
+    thread_pool empty(0);
+    EXPECT_EQ(evaluate_parallel(tree, empty, 16), evaluate(tree));
+}
+
+TEST(Evaluation, ParallelDeepNesting) {
+    thread_pool pool(3);
+    auto deep = parse(string(20000, '(') + "1+2" + string(20000, ')') + "+1");
+    EXPECT_EQ(evaluate_parallel(deep, pool), bigint(4));
+
+    string sum = "1";
+    for (int i = 0; i < 5000; ++i) {
+        sum.append(i % 2 ? "+(((2)))" : "-(3*(4))");
+    }
+    // Every input below nests its chains inside a top-level chain of a few operands, so
+    // only splitting the nested chains gives the pool work.
+    auto split = [&pool](node const& tree) {
+        auto before = pool.tasks_run();
+        EXPECT_EQ(evaluate_parallel(tree, pool, 64), evaluate(tree));
+        EXPECT_GT(pool.tasks_run() - before, 10u);
+    };
+    split(parse("-(((" + sum + ")))*2"));
+    split(parse("-(-(" + sum + "))"));
+    split(parse("(" + sum + ")*(" + sum + ")"));
+    split(parse(string(3000, '(') + sum + string(3000, ')') + "*(1-(2-(" + sum + ")))"));
+}
+
+TEST(Evaluation, Bytecode) {
+    auto formula = compile("price * (qty - -2) + price * 3 - +fee");
+    EXPECT_EQ(formula.variables(), (vector<string>{"price", "qty", "fee"}));
+    EXPECT_EQ(formula.variable("fee"), 2u);
+    EXPECT_EQ(formula.variable("tax"), program::NOT_FOUND);
+
+    size_t rows = 3 * program::LANES + 17;
+    vector<int64_t> price(rows), qty(rows), fee(rows), out(rows), parallel(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        price[i] = static_cast<int64_t>(i) - 100;
+        qty[i] = static_cast<int64_t>(i * i % 1000);
+        fee[i] = static_cast<int64_t>(i % 7);
+    }
+    formula.run({price.data(), qty.data(), fee.data()}, out.data(), rows);
+    thread_pool pool(3);
+    formula.run({price.data(), qty.data(), fee.data()}, parallel.data(), rows, pool);
+    for (size_t i = 0; i < rows; ++i) {
+        auto literal = "(" + std::to_string(price[i]) + ") * ((" + std::to_string(qty[i]) + ") - -2) + ("
+                       + std::to_string(price[i]) + ") * 3 - +(" + std::to_string(fee[i]) + ")";
+        EXPECT_EQ(bigint(out[i]), evaluate(parse(literal)));
+    }
+    EXPECT_EQ(out, parallel);
+
+    auto constant = compile("-(2 * 3)");
+    EXPECT_TRUE(constant.variables().empty());
+    int64_t value = 0;
+    constant.run({}, &value, 1);
+    EXPECT_EQ(value, -6);
+
+    EXPECT_THROW(compile("99999999999999999999 * x"), std::out_of_range);
+    EXPECT_THROW(formula.run({price.data()}, out.data(), rows), std::invalid_argument);
+    EXPECT_THROW(evaluate(parse("1 + x")), std::invalid_argument);
+}
+
+TEST(ThreadPool, TaskGroup) {
+    thread_pool pool(2);
+    std::atomic<int> counter{0};
+    task_group group(pool);
+    for (int i = 0; i < 1000; ++i) {
+        group.run([&counter] {
+            ++counter;
+        });
+    }
+    group.wait();
+    EXPECT_EQ(counter, 1000);
+
+    group.run([] {
+        throw std::runtime_error("task failed");
+    });
+    EXPECT_THROW(group.wait(), std::runtime_error);
+}
+
+TEST(Batch, OrderedLines) {
+    string input;
+    vector<string> expected;
+    for (size_t i = 1; i <= 1000; ++i) {
+        string line = (i % 7 == 0) ? "1 + $" : std::to_string(i) + " * (2 - 3)";
+        input += line + (i % 2 ? "\r\n" : "\n");
+        if (i % 7 == 0) {
+            expected.push_back("{\"line\":" + std::to_string(i) + ",\"error\":\"");
+        } else {
+            expected.push_back("{\"line\":" + std::to_string(i) + ",\"tree\":" +
+                               parse_flat(tokenize_buffer(line)).to_json(-1) + "}");
+        }
+    }
+    for (size_t threads : {1, 3}) {
+        istringstream in(input);
+        std::ostringstream out;
+        batch_options options;
+        options.threads = threads;
+        options.lines_per_batch = 16;
+        run_batch(in, out, options);
+        istringstream result(out.str());
+        string line;
+        size_t count = 0;
+        while (std::getline(result, line)) {
+            ASSERT_LT(count, expected.size());
+            if (line.back() == '}' && line.find("\"error\"") == string::npos) {
+                EXPECT_EQ(line, expected[count]);
+            } else {
+                EXPECT_EQ(line.compare(0, expected[count].size(), expected[count]), 0) << line;
+            }
+            ++count;
+        }
+        EXPECT_EQ(count, expected.size());
+    }
+}
+
+TEST(Batch, WorkerKeepsTokens) {
+    batch_worker worker;
+    string out;
+    worker.process("1 + 2", 1, true, out);
+    EXPECT_EQ(worker.tokens.source(), "1 + 2");
+    EXPECT_EQ(worker.tokens.size(), 4u);
+    worker.process("(3)", 2, false, out);
+    worker.process("4 * x", 3, true, out);
+    EXPECT_EQ(worker.tokens.source(), "4 * x");
+    EXPECT_EQ(out, "{\"line\":1,\"tree\":" + parse_ast(tokenize_buffer("1 + 2")).to_json() + "}\n"
+                   "{\"line\":2,\"tree\":" + parse_flat(tokenize_buffer("(3)")).to_json(-1) + "}\n"
+                   "{\"line\":3,\"tree\":" + parse_ast(tokenize_buffer("4 * x")).to_json() + "}\n");
+}
+
+TEST(Batch, WorkerKeepsTokensAfterErrors) {
+    string sum = "1";
+    for (int i = 0; i < 1000; ++i) {
+        sum += " + 1";
+    }
+    for (bool as_ast : {false, true}) {
+        batch_worker worker;
+        string out;
+        auto allocated = [&](string const& line) {
+            out.clear();
+            parse_stats stats;
+            {
+                stats_scope scope(stats);
+                worker.process(line, 1, as_ast, out);
+            }
+            return stats.allocated_bytes;
+        };
+        allocated(sum);
+        auto steady = allocated(sum);
+        for (string error : {"1 + $", "(1 +"}) {
+            allocated(error);
+            EXPECT_EQ(worker.tokens.source(), error);
+            EXPECT_EQ(allocated(sum), steady) << error;
+        }
+    }
+}
+
+static string exchange(int fd, string const& request) {
+    EXPECT_EQ(::send(fd, request.data(), request.size(), 0), static_cast<ssize_t>(request.size()));
+    ::shutdown(fd, SHUT_WR);
+    string res;
+    char chunk[4096];
+    for (ssize_t got; (got = ::read(fd, chunk, sizeof(chunk))) > 0;) {
+        res.append(chunk, static_cast<size_t>(got));
+    }
+    ::close(fd);
+    return res;
+}
+
+TEST(Server, Pipelining) {
+    string input;
+    for (size_t i = 1; i <= 300; ++i) {
+        input += (i % 5 == 0) ? "(1 + $" : std::to_string(i) + " * (2 - x)";
+        input += (i % 2 ? "\r\n" : "\n");
+    }
+    input += "7";
+    for (bool as_ast : {false, true}) {
+        std::istringstream in(input);
+        std::ostringstream expected;
+        batch_options batch;
+        batch.ast = as_ast;
+        run_batch(in, expected, batch);
+
+        server_options options;
+        options.threads = 3;
+        options.ast = as_ast;
+        options.max_in_flight = 16;
+        auto path = ::testing::TempDir() + "parser_server.sock";
+        parse_server server(path, options);
+        EXPECT_EQ(server.port(), 0u);
+        std::thread serving([&server] {
+            server.run();
+        });
+        vector<std::thread> clients;
+        vector<string> answers(4);
+        for (size_t i = 0; i < answers.size(); ++i) {
+            clients.emplace_back([&, i] {
+                answers[i] = exchange(connect_endpoint(path), input);
+            });
+        }
+        for (auto& item : clients) {
+            item.join();
+        }
+        for (auto const& answer : answers) {
+            EXPECT_EQ(answer, expected.str());
+        }
+        server.stop();
+        serving.join();
+    }
+
+    server_options options;
+    options.frames = FRAMING_LENGTH;
+    options.max_request = 100;
+    parse_server server(":0", options);
+    ASSERT_NE(server.port(), 0u);
+    std::thread serving([&server] {
+        server.run();
+    });
+    auto endpoint = ":" + std::to_string(server.port());
+    string request;
+    for (string expression : {"1 + 2", "", "(3"}) {
+        request += string{0, 0, 0, static_cast<char>(expression.size())} + expression;
+    }
+    auto answer = exchange(connect_endpoint(endpoint), request);
+    vector<string> objects;
+    for (size_t pos = 0; pos + 4 <= answer.size();) {
+        size_t length = static_cast<unsigned char>(answer[pos + 2]) << 8 | static_cast<unsigned char>(answer[pos + 3]);
+        objects.push_back(answer.substr(pos + 4, length));
+        pos += 4 + length;
+    }
+    ASSERT_EQ(objects.size(), 3u);
+    EXPECT_EQ(objects[0], "{\"line\":1,\"tree\":" + parse_flat(tokenize_buffer("1 + 2")).to_json(-1) + "}");
+    EXPECT_EQ(objects[1].compare(0, 18, "{\"line\":2,\"error\":"), 0) << objects[1];
+    EXPECT_EQ(objects[2].compare(0, 18, "{\"line\":3,\"error\":"), 0) << objects[2];
+    // A frame over max_request closes the connection.
+    EXPECT_EQ(exchange(connect_endpoint(endpoint), string{0, 0, 1, 0}), "");
+    server.stop();
+    serving.join();
+}
+
+TEST(Server, ClientThatDoesNotRead) {
+    server_options options;
+    options.threads = 1;
+    options.stop_timeout = std::chrono::milliseconds(100);
+    auto path = ::testing::TempDir() + "parser_server_idle.sock";
+    parse_server server(path, options);
+    std::thread serving([&server] {
+        server.run();
+    });
+    // Megabytes of answers that this client never reads back.
+    string sum = "1";
+    for (int i = 0; i < 50; ++i) {
+        sum += "+1";
+    }
+    string flood;
+    for (int i = 0; i < 1000; ++i) {
+        flood += sum + "\n";
+    }
+    int idle = connect_endpoint(path);
+    EXPECT_EQ(::send(idle, flood.data(), flood.size(), MSG_NOSIGNAL), static_cast<ssize_t>(flood.size()));
+    // The only worker must still be free for other clients.
+    EXPECT_EQ(exchange(connect_endpoint(path), "1 + 2\n"),
+              "{\"line\":1,\"tree\":" + parse_flat(tokenize_buffer("1 + 2")).to_json(-1) + "}\n");
+    // Stopping doesn't wait for it past stop_timeout.
+    auto start = std::chrono::steady_clock::now();
+    server.stop();
+    serving.join();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+    ::close(idle);
+}
+
 int main(int argc, char *argv[]) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-}
\ No newline at end of file
+}
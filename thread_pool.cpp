@@ -0,0 +1,133 @@
+#include "thread_pool.h"
+
+namespace {
+    thread_local thread_pool const *current_pool = nullptr;
+    thread_local size_t current_index = 0;
+}
+
+thread_pool::thread_pool(size_t workers) {
+    for (size_t i = 0; i <= workers; ++i) {
+        queues.push_back(std::make_unique<queue>());
+    }
+    for (size_t i = 0; i < workers; ++i) {
+        threads.emplace_back(&thread_pool::work, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &item : threads) {
+        item.join();
+    }
+}
+
+size_t thread_pool::own_queue() const {
+    return current_pool == this ? current_index : threads.size();
+}
+
+void thread_pool::submit(std::function<void()> task) {
+    auto &target = *queues[own_queue()];
+    {
+        std::lock_guard<std::mutex> guard(target.lock);
+        target.tasks.push_back(std::move(task));
+    }
+    ++queued;
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+    }
+    wake.notify_one();
+}
+
+bool thread_pool::pop(size_t self, std::function<void()> &task) {
+    {
+        auto &own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            --queued;
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); ++i) {
+        auto &victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            --queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool thread_pool::run_pending() {
+    std::function<void()> task;
+    if (!pop(own_queue(), task)) {
+        return false;
+    }
+    ++executed;
+    task();
+    return true;
+}
+
+void thread_pool::work(size_t self) {
+    current_pool = this;
+    current_index = self;
+    std::function<void()> task;
+    while (true) {
+        if (pop(self, task)) {
+            ++executed;
+            task();
+            task = nullptr;
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [this] {
+            return stopping || queued > 0;
+        });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+task_group::~task_group() {
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+void task_group::run(std::function<void()> task) {
+    ++pending;
+    pool.submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(error_lock);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        --pending;
+    });
+}
+
+void task_group::wait() {
+    while (pending > 0) {
+        if (!pool.run_pending()) {
+            std::this_thread::yield();
+        }
+    }
+    if (error) {
+        auto tmp = error;
+        error = nullptr;
+        std::rethrow_exception(tmp);
+    }
+}
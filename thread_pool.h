@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool: every worker owns a deque, pops its own tasks LIFO and steals
+// from the other deques FIFO. Threads outside the pool submit into a shared inbox.
+class thread_pool {
+    struct queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> executed{0};
+    std::atomic<bool> stopping{false};
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+
+    size_t own_queue() const;
+    bool pop(size_t self, std::function<void()> &task);
+    void work(size_t self);
+public:
+    explicit thread_pool(size_t workers = std::thread::hardware_concurrency());
+    ~thread_pool();
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    size_t size() const {
+        return threads.size();
+    }
+
+    void submit(std::function<void()> task);
+
+    // Runs one queued task on the calling thread, if there is any.
+    bool run_pending();
+
+    // Tasks started so far, by the workers or by run_pending().
+    size_t tasks_run() const {
+        return executed;
+    }
+};
+
+// Fork-join scope over a pool. wait() executes queued tasks while children are pending,
+// so nested groups cannot deadlock, and rethrows the first exception of a child.
+class task_group {
+    thread_pool &pool;
+    std::atomic<size_t> pending{0};
+    std::mutex error_lock;
+    std::exception_ptr error;
+public:
+    explicit task_group(thread_pool &pool) : pool(pool) {}
+    ~task_group();
+
+    void run(std::function<void()> task);
+    void wait();
+};
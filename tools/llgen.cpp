@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using std::set;
+using std::map;
+using std::cerr;
+
+static string const EPS = "EPS";
+static string const END = "END";
+
+struct rule {
+    string lhs;
+    vector<string> rhs;
+};
+
+struct grammar {
+    vector<string> nonterminals;
+    vector<rule> rules;
+
+    bool is_nonterminal(string const &x) const {
+        return std::find(nonterminals.begin(), nonterminals.end(), x) != nonterminals.end();
+    }
+};
+
+static grammar read_grammar(std::istream &in) {
+    grammar res;
+    string line;
+    size_t line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        string lhs, arrow;
+        if (!(words >> lhs)) {
+            continue;
+        }
+        if (!(words >> arrow) || arrow != "->") {
+            throw std::runtime_error("line " + std::to_string(line_no) + ": expected '->'");
+        }
+        if (!res.is_nonterminal(lhs)) {
+            res.nonterminals.push_back(lhs);
+        }
+        vector<string> rhs;
+        string word;
+        while (true) {
+            bool more = static_cast<bool>(words >> word);
+            if (!more || word == "|") {
+                if (rhs.empty()) {
+                    throw std::runtime_error("line " + std::to_string(line_no) + ": empty alternative");
+                }
+                if (rhs.size() > 1 && std::find(rhs.begin(), rhs.end(), EPS) != rhs.end()) {
+                    throw std::runtime_error("line " + std::to_string(line_no) + ": EPS must stand alone");
+                }
+                if (rhs == vector<string>{EPS}) {
+                    rhs.clear();
+                }
+                res.rules.push_back({lhs, rhs});
+                rhs.clear();
+                if (!more) {
+                    break;
+                }
+                continue;
+            }
+            rhs.push_back(word);
+        }
+    }
+    if (res.rules.empty()) {
+        throw std::runtime_error("grammar is empty");
+    }
+    return res;
+}
+
+// FIRST of a symbol string; contains EPS when the whole string can derive the empty string.
+static set<string> first_of(grammar const &g, map<string, set<string>> const &first,
+                            vector<string>::const_iterator begin, vector<string>::const_iterator end) {
+    set<string> res;
+    for (auto it = begin; it != end; ++it) {
+        if (!g.is_nonterminal(*it)) {
+            res.insert(*it);
+            return res;
+        }
+        auto const &cur = first.at(*it);
+        for (auto const &x : cur) {
+            if (x != EPS) {
+                res.insert(x);
+            }
+        }
+        if (!cur.count(EPS)) {
+            return res;
+        }
+    }
+    res.insert(EPS);
+    return res;
+}
+
+static string join(set<string> const &items) {
+    string res;
+    for (auto const &x : items) {
+        res.append(res.empty() ? "" : " ").append(x);
+    }
+    return res;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        cerr << "Usage: llgen <grammar> <output_header>\n";
+        return 1;
+    }
+    std::ifstream in(argv[1]);
+    if (!in.is_open()) {
+        cerr << "llgen: can't open " << argv[1] << '\n';
+        return 1;
+    }
+    grammar g;
+    try {
+        g = read_grammar(in);
+    } catch (std::exception const &e) {
+        cerr << argv[1] << ": " << e.what() << '\n';
+        return 1;
+    }
+
+    map<string, set<string>> first, follow;
+    for (auto const &x : g.nonterminals) {
+        first[x];
+        follow[x];
+    }
+    follow[g.nonterminals.front()].insert(END);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto const &r : g.rules) {
+            for (auto const &x : first_of(g, first, r.rhs.begin(), r.rhs.end())) {
+                changed |= first[r.lhs].insert(x).second;
+            }
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto const &r : g.rules) {
+            for (auto it = r.rhs.begin(); it != r.rhs.end(); ++it) {
+                if (!g.is_nonterminal(*it)) {
+                    continue;
+                }
+                auto rest = first_of(g, first, it + 1, r.rhs.end());
+                for (auto const &x : rest) {
+                    if (x != EPS) {
+                        changed |= follow[*it].insert(x).second;
+                    }
+                }
+                if (rest.count(EPS)) {
+                    for (auto const &x : follow[r.lhs]) {
+                        changed |= follow[*it].insert(x).second;
+                    }
+                }
+            }
+        }
+    }
+
+    map<string, map<string, size_t>> predict;
+    map<string, vector<string>> expected;
+    bool conflicts = false;
+    size_t max_rhs = 1;
+    for (size_t i = 0; i < g.rules.size(); ++i) {
+        auto const &r = g.rules[i];
+        max_rhs = std::max(max_rhs, r.rhs.size());
+        auto select = first_of(g, first, r.rhs.begin(), r.rhs.end());
+        if (select.erase(EPS)) {
+            select.insert(follow[r.lhs].begin(), follow[r.lhs].end());
+        }
+        for (auto const &x : select) {
+            auto ins = predict[r.lhs].emplace(x, i);
+            if (!ins.second) {
+                cerr << argv[1] << ": LL(1) conflict for " << r.lhs << " on " << x
+                     << " between alternatives " << ins.first->second << " and " << i << '\n';
+                conflicts = true;
+            } else {
+                expected[r.lhs].push_back(x);
+            }
+        }
+    }
+    if (conflicts) {
+        return 1;
+    }
+
+    std::ostringstream os;
+    os << "// Generated by llgen from " << argv[1] << ". Do not edit.\n";
+    os << "#pragma once\n\n";
+    os << "#include <array>\n";
+    os << "#include <cstdint>\n";
+    os << "#include \"lexer.h\"\n";
+    os << "#include \"parser.h\"\n\n";
+    os << "namespace grammar {\n";
+    for (auto const &x : g.nonterminals) {
+        os << "    // " << x << ": FIRST = { " << join(first[x]) << " }, FOLLOW = { " << join(follow[x]) << " }\n";
+    }
+    os << "\n";
+    os << "    enum symbol_kind : uint8_t {\n";
+    os << "        NONTERMINAL, TERMINAL, EPSILON, CLOSE\n";
+    os << "    };\n\n";
+    os << "    struct symbol {\n";
+    os << "        symbol_kind kind;\n";
+    os << "        uint8_t value;\n";
+    os << "    };\n\n";
+    os << "    struct production {\n";
+    os << "        node_type lhs;\n";
+    os << "        uint8_t size;\n";
+    os << "        symbol rhs[" << max_rhs << "];\n";
+    os << "    };\n\n";
+    os << "    struct token_list {\n";
+    os << "        token_type const *data;\n";
+    os << "        size_t size;\n";
+    os << "    };\n\n";
+    os << "    constexpr size_t token_type_count = END + 1;\n";
+    os << "    constexpr size_t node_type_count = EPS + 1;\n";
+    os << "    constexpr size_t max_rhs = " << max_rhs << ";\n";
+    os << "    constexpr node_type start = " << g.nonterminals.front() << ";\n\n";
+    os << "    constexpr production productions[] = {\n";
+    for (auto const &r : g.rules) {
+        os << "            {" << r.lhs << ", " << (r.rhs.empty() ? 1 : r.rhs.size()) << ", {";
+        if (r.rhs.empty()) {
+            os << "{EPSILON, 0}";
+        }
+        for (size_t i = 0; i < r.rhs.size(); ++i) {
+            os << (i ? ", " : "") << "{" << (g.is_nonterminal(r.rhs[i]) ? "NONTERMINAL" : "TERMINAL")
+               << ", " << r.rhs[i] << "}";
+        }
+        os << "}},\n";
+    }
+    os << "    };\n\n";
+    for (auto const &x : g.nonterminals) {
+        os << "    constexpr token_type expected_" << x << "[] = {";
+        for (size_t i = 0; i < expected[x].size(); ++i) {
+            os << (i ? ", " : "") << expected[x][i];
+        }
+        os << "};\n";
+    }
+    os << "\n";
+    os << "    constexpr std::array<token_list, node_type_count> make_expected() {\n";
+    os << "        std::array<token_list, node_type_count> res{};\n";
+    for (auto const &x : g.nonterminals) {
+        os << "        res[" << x << "] = {expected_" << x << ", " << expected[x].size() << "};\n";
+    }
+    os << "        return res;\n";
+    os << "    }\n\n";
+    os << "    constexpr auto expected = make_expected();\n\n";
+    os << "    // predict[nonterminal][lookahead] is the index of the production to expand, or -1.\n";
+    os << "    constexpr std::array<std::array<int8_t, token_type_count>, node_type_count> make_predict() {\n";
+    os << "        std::array<std::array<int8_t, token_type_count>, node_type_count> res{};\n";
+    os << "        for (auto &row : res) {\n";
+    os << "            for (auto &x : row) {\n";
+    os << "                x = -1;\n";
+    os << "            }\n";
+    os << "        }\n";
+    for (auto const &x : g.nonterminals) {
+        for (auto const &item : predict[x]) {
+            os << "        res[" << x << "][" << item.first << "] = " << item.second << ";\n";
+        }
+    }
+    os << "        return res;\n";
+    os << "    }\n\n";
+    os << "    constexpr auto predict = make_predict();\n";
+    os << "}\n";
+
+    auto text = os.str();
+    std::ifstream old(argv[2]);
+    std::stringstream current;
+    current << old.rdbuf();
+    if (current.str() != text) {
+        std::ofstream out(argv[2]);
+        out << text;
+        if (!out) {
+            cerr << "llgen: can't write " << argv[2] << '\n';
+            return 1;
+        }
+    }
+    return 0;
+}